@@ -1,4 +1,5 @@
 #include "2k_spanner.h"
+#include <algorithm>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
@@ -6,9 +7,12 @@
 #include <queue>
 #include <functional>
 #include <cassert>
+#include <cstdint>
 #include <iomanip>
+#include <tuple>
 #include "util.h"
 #include "graph.h"
+#include "sparse_accumulator.h"
 
 using namespace std;
 
@@ -40,18 +44,6 @@ namespace{
     return res;
   }
 
-  // returns all the vertices belonging to cluster_names from clusters.
-  vector<int> add_vertices_from_clusters(
-      const unordered_set<int>& cluster_names,
-      const Clusters& clusters) {
-    vector<int> result;
-    for (int vertex = 0; vertex < clusters.size(); ++vertex) {
-       if (cluster_names.count(clusters[vertex]) != 0)
-         result.push_back(vertex); 
-    }
-    return result;
-  }
-
   // Creates clusters corresponding to the cluster_names from clusters.
   Clusters create_clusters_from_samples(
       const unordered_set<int>& cluster_names,
@@ -108,22 +100,401 @@ namespace{
     return result;
   }
 
-  // Given a vertex 'vertex' returns a map where for each cluster in 'clusters'
-  // there is the value of a minimum edge from 'vertex' to that cluster.
-  auto create_cluster_to_min_edge_map(const Graph& g,
+  // Maps a cluster to the lightest edge from a vertex to it. Cluster names
+  // are their centers, so keys are in [0, n) and one accumulator per thread
+  // (cleared between vertices) serves a whole iteration.
+  using ClusterToMinEdge = SparseAccumulator<Edge>;
+
+  // Given a vertex 'vertex' fills 'cluster_representives' (which must be
+  // clear) with the value of a minimum edge from 'vertex' to each cluster in
+  // 'clusters'.
+  void create_cluster_to_min_edge_map(const Graph& g,
       int vertex,
-      const Clusters& clusters) {
-    std::unordered_map<int, Edge> cluster_representives;
+      const Clusters& clusters,
+      ClusterToMinEdge& cluster_representives) {
     for (const auto& e : g.neighbors(vertex)) {
-      int cluster = clusters[e.end];
-      auto current_rep = cluster_representives.find(cluster);
-      if (current_rep == std::end(cluster_representives)) {
-        cluster_representives.emplace(clusters[cluster], e);
-      } else if (current_rep->second > e) {
-        current_rep->second = e;
+      cluster_representives.min(clusters[e.end], e);
+    }
+  }
+
+  // Spanner edges found by one thread, added to the spanner once all the
+  // threads are done.
+  using EdgeBuffer = vector<ExtendedEdge>;
+
+  template<typename Spanner>
+  void add_buffers(vector<EdgeBuffer>& buffers, Spanner& spanner) {
+    for (auto& buffer : buffers) {
+      for (const auto& e : buffer)
+        spanner.add_edge(e.u, e.v, e.w);
+      buffer.clear();
+    }
+  }
+
+  // The edges every vertex drops in an iteration of the first phase. The
+  // vertices decide in parallel against the graph as it was at the start of
+  // the iteration, and the edges are dropped once all of them are done: a
+  // vertex with no sampled neighbor drops all of its edges, one that joins a
+  // sampled cluster drops its edges to the clusters it added edges to, that
+  // is the cluster it joins and those closer than its edge to it.
+  struct Drops {
+    struct Drop {
+      // True if v drops all of its edges.
+      bool all = false;
+      // The cluster v joins, -1 if none, and the weight of its edge to it.
+      int joined = -1;
+      double radius = 0;
+      // The other clusters v drops, sorted, are
+      // lists[owner][first, last): a list per thread, so that a vertex costs
+      // no allocation.
+      int owner = 0, first = 0, last = 0;
+    };
+    vector<Drop> of;
+    vector<vector<int>> lists;
+
+    explicit Drops(int n): of(n), lists(util::num_threads()) {}
+
+    // Forgets the previous iteration.
+    void clear() {
+      for (auto& list : lists)
+        list.clear();
+    }
+
+    // Forgets what v dropped in the previous iteration. Only the vertices
+    // still clustered need this, the others have no edges left.
+    void reset(int v) { of[v] = Drop(); }
+
+    // Records that v joins 'cluster' through an edge of weight 'w'. The
+    // clusters pushed to the returned list, until end_join(v), are the
+    // others v drops.
+    vector<int>& join(int v, int cluster, double w, int worker) {
+      auto& drop = of[v];
+      drop.joined = cluster;
+      drop.radius = w;
+      drop.owner = worker;
+      drop.first = lists[worker].size();
+      return lists[worker];
+    }
+
+    void end_join(int v) {
+      auto& drop = of[v];
+      auto& list = lists[drop.owner];
+      drop.last = list.size();
+      std::sort(std::begin(list) + drop.first, std::end(list));
+    }
+
+    // True if the vertex whose drops are 'drop' drops its edge e to a vertex
+    // of 'cluster'. The list is only searched for edges at least as heavy as
+    // its radius, an edge below it is dropped because its cluster is closer.
+    bool drops(const Drop& drop, int cluster, const Edge& e) const {
+      if (drop.all)
+        return true;
+      if (drop.joined == -1)
+        return false;
+      if (cluster == drop.joined || e.w < drop.radius)
+        return true;
+      const auto& list = lists[drop.owner];
+      return std::binary_search(std::begin(list) + drop.first,
+          std::begin(list) + drop.last, cluster);
+    }
+  };
+
+  // Removes the edges dropped by either of their ends and the intra cluster
+  // edges of 'next', the new clustering, from the edges of 'vertices' (all
+  // the vertices that have edges). Every vertex filters its own list, in
+  // parallel.
+  void drop_edges(Graph& g, const vector<int>& vertices,
+      const Clusters& clusters, const Clusters& next, const Drops& drops) {
+    util::parallel_for(0, vertices.size(), [&] (int, int i) {
+      const int v = vertices[i];
+      const auto& drop = drops.of[v];
+      const int v_cluster = clusters[v];
+      const int v_next = next[v];
+      if (drop.all) {
+        g.filter_neighbors(v, [] (const Edge&) { return true; });
+        return;
       }
+      g.filter_neighbors(v, [&] (const Edge& e) {
+          return (v_next != -1 && v_next == next[e.end]) ||
+            drops.drops(drop, clusters[e.end], e) ||
+            drops.drops(drops.of[e.end], v_cluster, e);
+      });
+    }, 64);
+  }
+
+  // The vertices of a task of a VertexTasks loop, if they aren't hubs.
+  constexpr size_t kVerticesPerTask = 64;
+
+  // A per-vertex loop split into tasks for parallel_for: ranges of
+  // kVerticesPerTask vertices of the loop's list, and chunks of the hubs,
+  // the vertices with at least 'threshold' neighbors. A hub's neighbor set is
+  // split by hash buckets into chunks of about threshold / 2 neighbors, so a
+  // few hubs of a power-law graph don't serialize the loop. The hub chunks
+  // come first, so the threads start with the largest tasks and then take
+  // the ranges as they are done.
+  class VertexTasks {
+    public:
+      struct Task {
+        // -1 for the vertices [first, last) of the loop's list. Otherwise a
+        // hub, whose neighbors in the buckets [first, last) of its neighbor
+        // set are the task's, and 'chunk' is the task's index among the
+        // chunks of all the hubs.
+        int hub;
+        size_t first, last;
+        int chunk;
+      };
+
+      // Splits a loop over 'vertices'. Only the vertices for which take(v)
+      // holds can be hubs, a threshold <= 0 means none is.
+      template<typename Take>
+      void split(const Graph& g, const vector<int>& vertices, int threshold,
+          Take&& take) {
+        hub_mark.resize(g.size(), 0);
+        for (int hub : hubs_)
+          hub_mark[hub] = 0;
+        hubs_.clear();
+        first_chunks.clear();
+        tasks_.clear();
+        for (size_t i = 0; threshold > 0 && i < vertices.size(); ++i) {
+          const int hub = vertices[i];
+          const auto& neighbors = g.neighbors(hub);
+          if (neighbors.size() < static_cast<size_t>(threshold) || !take(hub))
+            continue;
+          hub_mark[hub] = 1;
+          hubs_.push_back(hub);
+          first_chunks.push_back(tasks_.size());
+          const size_t buckets = neighbors.bucket_count();
+          const size_t chunks = std::min(buckets,
+              (2 * neighbors.size() + threshold - 1) / threshold);
+          for (size_t chunk = 0; chunk < chunks; ++chunk) {
+            tasks_.push_back({hub, buckets * chunk / chunks,
+                buckets * (chunk + 1) / chunks,
+                static_cast<int>(tasks_.size())});
+          }
+        }
+        // The hub chunks are the first tasks.
+        first_chunks.push_back(tasks_.size());
+        for (size_t first = 0; first < vertices.size();
+            first += kVerticesPerTask) {
+          tasks_.push_back({-1, first,
+              std::min(vertices.size(), first + kVerticesPerTask), -1});
+        }
+      }
+
+      const vector<Task>& tasks() const { return tasks_; }
+      const vector<int>& hubs() const { return hubs_; }
+      bool is_hub(int v) const { return hub_mark[v]; }
+      int chunks() const { return first_chunks.back(); }
+      // The chunks of the i'th hub are [first_chunk(i), first_chunk(i + 1)).
+      int first_chunk(int i) const { return first_chunks[i]; }
+
+      // Calls f(e) for every neighbor e of the hub of a chunk.
+      template<typename F>
+      static void for_each_neighbor(const Graph& g, const Task& chunk,
+          F&& f) {
+        const auto& neighbors = g.neighbors(chunk.hub);
+        for (size_t bucket = chunk.first; bucket < chunk.last; ++bucket)
+          for (auto e = neighbors.begin(bucket); e != neighbors.end(bucket);
+              ++e)
+            f(*e);
+      }
+
+      // Calls f(v, e) for every edge e of a vertex v of a task, the hubs'
+      // edges being in their chunks rather than in the ranges.
+      template<typename F>
+      void for_each_edge(const Graph& g, const vector<int>& vertices,
+          const Task& task, F&& f) const {
+        if (task.hub != -1) {
+          for_each_neighbor(g, task, [&] (const Edge& e) { f(task.hub, e); });
+          return;
+        }
+        for (size_t i = task.first; i < task.last; ++i) {
+          if (is_hub(vertices[i]))
+            continue;
+          for (const auto& e : g.neighbors(vertices[i]))
+            f(vertices[i], e);
+        }
+      }
+
+    private:
+      vector<Task> tasks_;
+      vector<int> hubs_;
+      // hubs_.size() + 1 entries, the last one is the number of chunks.
+      vector<int> first_chunks;
+      vector<char> hub_mark;
+  };
+
+  // The lightest edge from each hub to each of its neighboring clusters.
+  // Every chunk finds its own lightest edges and sends each of them to the
+  // partition of its cluster (one per thread), then the (hub, partition)
+  // pairs are min-reduced in parallel.
+  class HubMinEdges {
+    public:
+      // Makes room for the chunks of 'tasks', before the chunks are scanned.
+      void start(const VertexTasks& tasks) {
+        partitions = util::num_threads();
+        parts.resize(std::max<size_t>(parts.size(),
+              tasks.chunks() * partitions));
+        for (int i = 0; i < tasks.chunks() * partitions; ++i)
+          parts[i].clear();
+      }
+
+      // Scans the edges e of a chunk for which keep(e) holds, 'min_edges' is
+      // the calling thread's.
+      template<typename Keep>
+      void scan(const Graph& g, const VertexTasks::Task& chunk,
+          const Clusters& clusters, Keep&& keep, ClusterToMinEdge& min_edges) {
+        min_edges.clear();
+        VertexTasks::for_each_neighbor(g, chunk, [&] (const Edge& e) {
+          if (keep(e))
+            min_edges.min(clusters[e.end], e);
+        });
+        for (int cluster : min_edges.keys()) {
+          parts[chunk.chunk * partitions + cluster % partitions].push_back(
+              {cluster, min_edges[cluster]});
+        }
+      }
+
+      // Once all the chunks are scanned.
+      void reduce(const Graph& g, const VertexTasks& tasks,
+          vector<ClusterToMinEdge>& min_edges) {
+        const int hubs = tasks.hubs().size();
+        reduced.resize(std::max<size_t>(reduced.size(), hubs * partitions));
+        util::parallel_for(0, hubs * partitions, [&] (int worker, int i) {
+          const int hub = i / partitions;
+          const int partition = i % partitions;
+          auto& lightest = min_edges[worker];
+          lightest.grow(g.size(), Edge{-1, 0});
+          lightest.clear();
+          for (int chunk = tasks.first_chunk(hub);
+              chunk < tasks.first_chunk(hub + 1); ++chunk) {
+            for (const auto& ce : parts[chunk * partitions + partition])
+              lightest.min(ce.cluster, ce.min_edge);
+          }
+          auto& out = reduced[i];
+          out.clear();
+          for (int cluster : lightest.keys())
+            out.push_back({cluster, lightest[cluster]});
+        });
+      }
+
+      // Calls f(cluster, edge) with the lightest edge from the i'th hub to
+      // each of its neighboring clusters.
+      template<typename F>
+      void for_each_min_edge(int i, F&& f) const {
+        for (int partition = 0; partition < partitions; ++partition)
+          for (const auto& ce : reduced[i * partitions + partition])
+            f(ce.cluster, ce.min_edge);
+      }
+
+    private:
+      int partitions = 1;
+      // [chunk * partitions + partition].
+      vector<vector<ClusterAndEdge>> parts;
+      // [hub * partitions + partition].
+      vector<vector<ClusterAndEdge>> reduced;
+  };
+
+  // What an iteration of the first phase keeps between its passes.
+  struct PhaseState {
+    PhaseState(int n, vector<ClusterToMinEdge>& min_edges,
+        int hub_degree_threshold):
+      hub_degree_threshold(hub_degree_threshold), min_edges(min_edges),
+      buffers(util::num_threads()), drops(n) {
+      min_edges.resize(util::num_threads());
     }
-    return cluster_representives;
+
+    // See VertexTasks.
+    int hub_degree_threshold;
+    // Per thread.
+    vector<ClusterToMinEdge>& min_edges;
+    vector<EdgeBuffer> buffers;
+    Drops drops;
+    VertexTasks tasks;
+    HubMinEdges hub_min_edges;
+  };
+
+  // The decision of a vertex v outside of the sampled clusters, given
+  // for_each_min_edge(f), which calls f(cluster, edge) with the lightest
+  // edge from v to each of its neighboring clusters.
+  template<typename ForEach, typename Sampled>
+  void decide_vertex(int v, ForEach&& for_each_min_edge, Sampled&& sampled,
+      int worker, Clusters& next, PhaseState& state) {
+    ClusterAndEdge best_sampled =
+      {-1, {-1, std::numeric_limits<double>::max()}};
+    for_each_min_edge([&] (int cluster, const Edge& edge) {
+      if (sampled(edge.end) && edge < best_sampled.min_edge)
+        best_sampled = {cluster, edge};
+    });
+    auto& buffer = state.buffers[worker];
+    // If the vertex has no adjacent sampled clusters, we add the minimum
+    // edge of all of its neighbors.
+    if (!best_sampled) {
+      state.drops.of[v].all = true;
+      for_each_min_edge([&] (int, const Edge& edge) {
+        buffer.emplace_back(v, edge.end, edge.w);
+      });
+      return;
+    }
+    // v is adjacent to a sampled cluster.
+    next[v] = best_sampled.cluster;
+    auto& dropped = state.drops.join(v, best_sampled.cluster,
+        best_sampled.min_edge.w, worker);
+    for_each_min_edge([&] (int cluster, const Edge& edge) {
+      if (cluster == best_sampled.cluster || edge < best_sampled.min_edge) {
+        // Now we remove all edges corresponding to this cluster.
+        if (cluster != best_sampled.cluster)
+          dropped.push_back(cluster);
+        buffer.emplace_back(v, edge.end, edge.w);
+      }
+    });
+    state.drops.end_join(v);
+  }
+
+  // The decisions of an iteration: every vertex of 'vertices' (V_i) outside
+  // of the sampled clusters (sampled(u) tells if u is in one) decides, in
+  // parallel against the graph as it is, with the lightest edge to each of
+  // its neighboring clusters in 'clusters'. Their spanner edges go to
+  // state.buffers, what they drop to state.drops and the clusters they join
+  // to 'next'. The hubs' chunks are scanned as tasks of the same loop and
+  // the hubs decide once their chunks are reduced.
+  template<typename Sampled>
+  void decide(const Graph& g, const vector<int>& vertices,
+      const Clusters& clusters, Sampled&& sampled, Clusters& next,
+      PhaseState& state) {
+    auto& tasks = state.tasks;
+    tasks.split(g, vertices, state.hub_degree_threshold,
+        [&] (int v) { return !sampled(v); });
+    state.hub_min_edges.start(tasks);
+    state.drops.clear();
+    util::parallel_for(0, tasks.tasks().size(), [&] (int worker, int t) {
+      const auto& task = tasks.tasks()[t];
+      auto& min_edges = state.min_edges[worker];
+      min_edges.grow(g.size(), Edge{-1, 0});
+      if (task.hub != -1) {
+        state.hub_min_edges.scan(g, task, clusters,
+            [] (const Edge&) { return true; }, min_edges);
+        return;
+      }
+      for (size_t i = task.first; i < task.last; ++i) {
+        const int v = vertices[i];
+        state.drops.reset(v);
+        // Only iterate non vertices not in sampled clusters.
+        if (sampled(v) || tasks.is_hub(v))
+          continue;
+        min_edges.clear();
+        create_cluster_to_min_edge_map(g, v, clusters, min_edges);
+        decide_vertex(v, [&] (auto&& f) {
+              for (int cluster : min_edges.keys())
+                f(cluster, min_edges[cluster]);
+            }, sampled, worker, next, state);
+      }
+    });
+    state.hub_min_edges.reduce(g, tasks, state.min_edges);
+    util::parallel_for(0, tasks.hubs().size(), [&] (int worker, int i) {
+      decide_vertex(tasks.hubs()[i], [&] (auto&& f) {
+            state.hub_min_edges.for_each_min_edge(i, f);
+          }, sampled, worker, next, state);
+    });
   }
 
   bool is_sampled(int vertex, const std::unordered_set<int>& samples,
@@ -176,115 +547,115 @@ namespace{
     vector<int> V_i_next;
     Clusters C_i_next;
     Clusters C_before_last;
-    int edges_added = 0;
     const double& probability = pow(g.size(), -1.0 / static_cast<double>(k));
+    vector<ClusterToMinEdge> cluster_min_edge_maps;
+    PhaseState state(g.size(), cluster_min_edge_maps,
+        util::get_int_flag("hub_degree_threshold"));
     for (int i = 0; i < k / 2 ; ++i) {
       auto R_i = sample(C_i, probability);
-      V_i_next = add_vertices_from_clusters(R_i, C_i);
       C_i_next = create_clusters_from_samples(R_i, C_i);
       //print_iteration_info(i, C_i, R_i, out);
 
-      for (auto v : V_i) {
-        // Only iterate non vertices not in sampled clusters.
-        if (is_sampled(v, R_i, C_i)) {
-          continue;
-        }
-        auto cluster_min_edge_map = create_cluster_to_min_edge_map(g, v, C_i);
-        // If the vertex has no adjacent sampled clusters, we add the minimum
-        // edge of all of its neighbors.
-        if (std::none_of(std::begin(g.neighbors(v)),
-              std::end(g.neighbors(v)),
-              [&] (const auto& neighbor) {
-              return is_sampled(neighbor.end, R_i, C_i);})) {
-          g.clear_neighbors(v);
-          for (auto&& cluster_and_edge : cluster_min_edge_map) {
-            ++edges_added;
-            spanner.add_edge(v,
-                cluster_and_edge.second.end,
-                cluster_and_edge.second.w);
-          } 
-        } else {  // V is adjacent to a sampled cluster.
-          ClusterAndEdge sentinel_edge =
-            {-1, {-1, std::numeric_limits<double>::max()}};
-          auto best_sampled = std::accumulate(std::begin(cluster_min_edge_map),
-              std::end(cluster_min_edge_map), sentinel_edge,
-              [&] (auto&& best_sampled, auto&& next) {
-                if (is_sampled(next.second.end, R_i, C_i)
-                    && next.second < best_sampled.min_edge)
-                    return ClusterAndEdge{next.first, next.second}; 
-                return best_sampled;
-              });
-          assert(best_sampled.cluster != sentinel_edge.cluster);
-          C_i_next[v] = best_sampled.cluster;
-          V_i_next.push_back(v);
-          for (const auto& cluster_and_edge : cluster_min_edge_map) {
-            const auto& cluster = cluster_and_edge.first;
-            const auto& min_edge = cluster_and_edge.second;
-            if (cluster == best_sampled.cluster ||
-                min_edge < best_sampled.min_edge) {
-              // Now we remove all edges corresponding to this cluster.
-              g.remove_neighbors(v, [&] (int neighbor) {
-                  return C_i[neighbor] == cluster;});
-              spanner.add_edge(v, min_edge.end, min_edge.w);
-              ++edges_added;
-            }
-          }
+      decide(g, V_i, C_i,
+          [&] (int v) { return is_sampled(v, R_i, C_i); }, C_i_next, state);
+      add_buffers(state.buffers, spanner);
 
-        } 
-      }
-
-      // Remove intra cluster edgez.
-      for (int vertex = 0; vertex < g.size(); ++vertex) {
-        if (C_i_next[vertex] != -1) {
-          g.remove_neighbors(vertex, [&] (auto&& u) {
-              return C_i_next[vertex] == C_i_next[u];});
-        }
-      }
+      // Remove the dropped and the intra cluster edgez.
+      drop_edges(g, V_i, C_i, C_i_next, state.drops);
 
       // Next iteration initializations.
+      V_i_next.clear();
+      std::copy_if(std::begin(V_i), std::end(V_i),
+          std::back_inserter(V_i_next),
+          [&] (int v) { return C_i_next[v] != -1; });
       C_before_last = std::move(C_i);
       C_i = std::move(C_i_next);
-      V_i = std::move(V_i_next);
+      std::swap(V_i, V_i_next);
     }
 
-    return form_cluster_ret {C_i, C_before_last, g};
+    return form_cluster_ret {std::move(C_i), std::move(C_before_last),
+      std::move(g)};
   }
 
 
-  template<typename Container, typename Key, typename Value, typename KeyPred,
-    typename ValuePred>
-  void replace_if_pred_in_map(Container& container, Key&& key, Value&& v,
-                              KeyPred&& key_pred, ValuePred&& value_pred) {
-    auto iter = std::find_if(std::begin(container),
-                          std::end(container),
-                          [&] (auto&& a) {
-                            return key_pred(a.first, key) &&
-                            value_pred(a.second, v);});
-    if (iter == std::end(container)) {
-      container.emplace(key, v);
-    } else if (value_pred(iter->second, v)) {
-      iter->second = v;
-    }
-  }
+  // The lightest edge between each unordered pair of clusters: an open
+  // addressing table keyed on the pair packed into 64 bits, (min, max), so a
+  // lookup hashes and compares a single word.
+  class ClusterPairMinEdge {
+    public:
+      ClusterPairMinEdge(): keys(kMinCapacity), values(kMinCapacity),
+        used(kMinCapacity, 0) {}
 
-  auto join_clusters(const Graph& not_yet_added, Graph& spanner,
-      const Clusters& last_clustering, const Clusters& before_last_clustering) {
-    auto pair_hash = [] (const std::pair<int, int>& pair) -> size_t {
-      return pair.first ^ pair.second;
-    };
+      // Keeps e for the pair {a, b} if it has no edge yet or e is lighter.
+      void min(int a, int b, const ExtendedEdge& e) {
+        if (2 * (count + 1) > keys.size())
+          rehash(2 * keys.size());
+        const uint64_t key = pack(a, b);
+        size_t slot = find(key);
+        if (!used[slot]) {
+          used[slot] = 1;
+          keys[slot] = key;
+          values[slot] = e;
+          ++count;
+        } else if (e.w < values[slot].w) {
+          values[slot] = e;
+        }
+      }
 
-    auto compare_pairs = [] (const std::pair<int, int>& a,
-                           const std::pair<int, int>& b) {
-      return (a.first == b.first && b.second == a.second) ||
-             (a.second == b.first && a.first == b.second);
-    };
+      template<typename F>
+      void for_each(F&& f) const {
+        for (size_t slot = 0; slot < keys.size(); ++slot)
+          if (used[slot])
+            f(values[slot]);
+      }
+
+    private:
+      static constexpr size_t kMinCapacity = 16;
 
+      static uint64_t pack(int a, int b) {
+        if (b < a)
+          std::swap(a, b);
+        return (uint64_t(uint32_t(a)) << 32) | uint32_t(b);
+      }
+
+      // The slot of 'key', or the empty slot where it goes. The capacity is
+      // a power of two, the hash is the top bits of a Fibonacci product.
+      size_t find(uint64_t key) const {
+        const size_t mask = keys.size() - 1;
+        size_t slot = (key * 0x9e3779b97f4a7c15ull) >> (64 - bits);
+        while (used[slot] && keys[slot] != key)
+          slot = (slot + 1) & mask;
+        return slot;
+      }
 
-    std::unordered_map<std::pair<int, int>,
-                        ExtendedEdge,
-                        decltype(pair_hash),
-                        decltype(compare_pairs)>
-                          map(1, pair_hash, compare_pairs);
+      void rehash(size_t capacity) {
+        auto old_keys = std::move(keys);
+        auto old_values = std::move(values);
+        auto old_used = std::move(used);
+        keys.assign(capacity, 0);
+        values.assign(capacity, ExtendedEdge());
+        used.assign(capacity, 0);
+        ++bits;
+        for (size_t slot = 0; slot < old_keys.size(); ++slot) {
+          if (old_used[slot]) {
+            const size_t to = find(old_keys[slot]);
+            used[to] = 1;
+            keys[to] = old_keys[slot];
+            values[to] = old_values[slot];
+          }
+        }
+      }
+
+      vector<uint64_t> keys;
+      vector<ExtendedEdge> values;
+      vector<char> used;
+      size_t count = 0;
+      int bits = 4;  // log2 of the capacity.
+  };
+
+  void join_clusters(const Graph& not_yet_added, Graph& spanner,
+      const Clusters& last_clustering, const Clusters& before_last_clustering) {
+    ClusterPairMinEdge min_edges;
     // Now we iterate over all the edges in not_yet_added maintaining the min
     // edge for each pair of clusters.
     for (int v = 0; v < not_yet_added.size(); ++v) {
@@ -294,250 +665,255 @@ namespace{
       for (const auto& edge : not_yet_added.neighbors(v)) {
         //assert(clusters[edge.end] != v_cluster);
         int neighbor_cluster = before_last_clustering[edge.end];
-        replace_if_pred_in_map<decltype(map)>(map,
-            std::make_pair(v_cluster, neighbor_cluster),
-            ExtendedEdge(v, edge.end, edge.w), compare_pairs,
-            [&] (const ExtendedEdge& old, const ExtendedEdge& new_key) {
-                return old.w > new_key.w; 
-                }
-            );
-       }
-    }
-    for(const auto& e : map) {
-      spanner.add_edge(e.second.u, e.second.v, e.second.w);
+        min_edges.min(v_cluster, neighbor_cluster,
+            ExtendedEdge(v, edge.end, edge.w));
+      }
     }
+    min_edges.for_each([&] (const ExtendedEdge& e) {
+      spanner.add_edge(e.u, e.v, e.w);
+    });
   }
 }  // namespace.
 
 namespace {
 
-  // Initialize V_i to 0 ... n-1
-  auto initialize_V(const Graph& g) {
-    std::unordered_set<int> res;
-    for (int i = 0; i < g.size(); ++i)
-      res.emplace(i);
-    return res;
-  }
-  // Initialize the clusters to be {{v} | v in G}
-  auto initialize_Clusters(const Graph& g) {
-    std::unordered_map<int, int> vertex_cluster_map;
-    for (int v = 0;  v < g.size(); v++) {
-      vertex_cluster_map.emplace(v, v); 
-    }
-    return vertex_cluster_map;
-  }
+  // The clusterings of the first phase are Clusters: the center of every
+  // clustered vertex, -1 for the others. The clustered vertices, V_i, are
+  // kept as a sorted vector too, to go over them.
 
-  auto sample_clusters(const std::unordered_map<int, int>& clusters, int k, int n) {
+  // Samples each center of 'clusters' with probability n^(-1/k). Returns
+  // whether each vertex is a sampled center, and the sampled centers in
+  // increasing order in 'centers'.
+  vector<char> sample_clusters(const Clusters& clusters,
+      const vector<int>& vertices, int k, vector<int>& centers) {
+    const int n = clusters.size();
     // The probability of sampling a cluster.
     const double probability = pow(n, -1.0 / static_cast<double>(k));
-
-    std::unordered_set<int> sampled_clusters;
-    std::unordered_set<int> all_clusters;
-    for (auto&& vertex_cluster : clusters) {
-      all_clusters.emplace(vertex_cluster.second);
-    }
-                    
-    for (auto rep : all_clusters) {
-      if (random_real() < probability) {
-        sampled_clusters.emplace(rep);
-      }
+    vector<char> sampled(n, 0);
+    for (int v : vertices)
+      sampled[clusters[v]] = 1;
+    centers.clear();
+    for (int center = 0; center < n; ++center) {
+      if (sampled[center] && random_real() < probability)
+        centers.push_back(center);
+      else
+        sampled[center] = 0;
     }
-
-    return sampled_clusters;
+    return sampled;
   }
 
   // Return true if v's cluster is sampled.
-  inline bool is_vertex_sampled(const std::unordered_set<int>& samples,
-                         const std::unordered_map<int,int>& clusters,
-                         int v) {
-    auto vertex_entry = clusters.find(v);
-    // Vertex must exist.
-    assert(vertex_entry != std::end(clusters));
-    return samples.count(vertex_entry->second) > 0;
-  }
-
-  // Returns all the vertices in sampled clusters.
-  auto vertices_from_sampled_clusters(
-      const std::unordered_set<int>& sampled_clusters,
-      const std::unordered_map<int, int>& clusters) {
-    std::unordered_set<int> v_i_next;
-    for (auto&& vertex_cluster : clusters) {
-      if (sampled_clusters.count(vertex_cluster.second) > 0)
-        v_i_next.emplace(vertex_cluster.first);
-    }
-    return v_i_next;
-  }
-
-  // Returns a clustering, that consists only of the sampled clusters
-  auto clusters_from_sample(const std::unordered_map<int, int>& prev_clusters,
-                            const std::unordered_set<int>& samples) {
-    std::unordered_map<int, int> new_clusters;
-    std::copy_if(std::begin(prev_clusters),
-                 std::end(prev_clusters),
-                 std::inserter(new_clusters, std::end(new_clusters)),
-                 [&samples] (const auto& vertex_cluster) {
-                   return samples.count(vertex_cluster.second) > 0;
-                 });
-    return new_clusters;
-  }
-
-  // Given a vertex v in g, a map of cluster->min_edge s.t min_edge is the
-  // nearest vertex u in cluster 'c' to v.
-  std::unordered_map<int, Edge> cluster_to_min_edge_map(
-      const Graph& g,
-      int vertex,
-      const std::unordered_map<int, int>& clusters) {
-    std::unordered_map<int, Edge> cluster_representives;
-    for (const auto& e : g.neighbors(vertex)) {
-      int cluster = clusters.find(e.end)->second;
-      auto current_rep = cluster_representives.find(cluster);
-      if (current_rep == std::end(cluster_representives)) {
-        cluster_representives.emplace(clusters.find(e.end)->second, e);
-      } else if (current_rep->second > e) {
-        current_rep->second = e;
-      }
-    }
-    return cluster_representives;
+  inline bool is_vertex_sampled(const vector<char>& samples,
+                         const Clusters& clusters, int v) {
+    // Vertex must be clustered.
+    assert(clusters[v] != -1);
+    return samples[clusters[v]];
   }
 
   struct form_cluster2_ret {
-    std::unordered_map<int, int> last_clustering, before_last;
+    Clusters last_clustering, before_last;
     Graph not_added;
-    std::unordered_set<int> remaining_vertices;
+    vector<int> remaining_vertices;
   };
 
 
-  // If v has a sampled neighbor, the nearest one is returned. If v has no such
-  // neighbors 'empty' is returned.
-  ClusterAndEdge nearest_sampled_neighbor(
-      const Graph& g, int vertex,
-      const std::unordered_set<int>& sampled_clusters,
-      const std::unordered_map<int, int>& clustering,
-      const std::unordered_map<int, Edge>& cluster_min_edge_map) {
-    ClusterAndEdge sentinel_edge =
-    {-1, {-1, std::numeric_limits<double>::max()}};
-    return std::accumulate(std::begin(cluster_min_edge_map),
-        std::end(cluster_min_edge_map), sentinel_edge,
-        [&] (auto&& best_sampled, auto&& next) {
-        if (is_vertex_sampled(sampled_clusters, clustering, next.second.end)
-            && next.second < best_sampled.min_edge) {
-            return ClusterAndEdge{next.first, next.second}; 
-        }
-        return best_sampled;
-        });
-  }
-
-  //
-  auto form_clusters_2(Graph g, Graph& spanner, int k, int iters) {
-    // Maps each vertex to its cluster.
-    std::unordered_set<int> V_i = initialize_V(g);
-    // Clusters are represented as an array of size |V| where C_i[u] points to
-    // center of the cluster, vertex u is in.
-    auto C_i = initialize_Clusters(g);
+  // Runs 'iters' iterations of the first phase, recording the centers of each
+  // clustering in 'hierarchy' if it isn't null. 'spanner' is a Graph or an
+  // EdgeList, only its add_edge is used.
+  template<typename Spanner>
+  auto form_clusters_2(Graph g, Spanner& spanner, int k, int iters,
+      vector<ClusterToMinEdge>& cluster_min_edge_maps,
+      int hub_degree_threshold, ClusterHierarchy* hierarchy = nullptr) {
+    // The clustered vertices, all of them at first.
+    vector<int> V_i = numbers_to_n(g.size());
+    // C_i[u] is the center of the cluster vertex u is in, every vertex is its
+    // own cluster at first.
+    Clusters C_i = numbers_to_n(g.size());
     // These represent the vertices and the clusters that will be used in the
     // next iteration.
-    decltype(V_i) V_i_next;
-    decltype(C_i) C_i_next;
-    decltype(C_i) C_before_last;
+    vector<int> V_i_next;
+    Clusters C_i_next;
+    Clusters C_before_last;
+    vector<int> centers;
+    PhaseState state(g.size(), cluster_min_edge_maps, hub_degree_threshold);
+    if (hierarchy) {
+      hierarchy->centers.assign(1, numbers_to_n(g.size()));
+    }
     for (int i = 0; i < iters ; ++i) {
       // Sample clusters from C_i for this iteration.
-      auto R_i = sample_clusters(C_i, k, g.size());
-      // Initialize V_{i+1} and C_i_{i+1}
-      V_i_next = vertices_from_sampled_clusters(R_i, C_i);
-      C_i_next = clusters_from_sample(C_i, R_i);
-      // Now we process each vertex in V_i, not belonging to any sampled cluster
-      for (int v : V_i) {
-        if (is_vertex_sampled(R_i, C_i, v))
-          continue;
-        auto cluster_min_edge_map = cluster_to_min_edge_map(g, v, C_i);
-        auto maybe_best_sampled = nearest_sampled_neighbor(
-            g, v, R_i, C_i, cluster_min_edge_map);
-        if (!maybe_best_sampled) {
-          g.clear_neighbors(v);
-          for (const auto& cluster_and_edge : cluster_min_edge_map) {
-            const auto& edge = cluster_and_edge.second;
-            spanner.add_edge(v, edge.end, edge.w);
-          }
-        } else {  // v is adjacent to sampled vertices.
-          const auto& best_sampled = maybe_best_sampled;
-          C_i_next.emplace(v, best_sampled.cluster);
-          V_i_next.emplace(v);
-          for (const auto& cluster_and_edge : cluster_min_edge_map) {
-            const auto& cluster = cluster_and_edge.first;
-            const auto& min_edge = cluster_and_edge.second;
-            if (cluster == best_sampled.cluster ||
-                min_edge < best_sampled.min_edge) {
-              // Now we remove all edges corresponding to this cluster.
-              g.remove_neighbors(v, [&] (int neighbor) {
-                  return C_i[neighbor] == cluster;});
-              spanner.add_edge(v, min_edge.end, min_edge.w);
-            }
-          } 
-        }
+      const auto R_i = sample_clusters(C_i, V_i, k, centers);
+      if (hierarchy) {
+        hierarchy->centers.push_back(centers);
       }
-      // Now we need to remove the intra cluster edges.
-      for (int vertex : V_i_next) {
-        g.remove_neighbors(vertex,
-            [&] (auto&& u) { return C_i_next[vertex] == C_i_next[u]; });
+      // Initialize C_{i+1} to the sampled clusters.
+      C_i_next.assign(g.size(), -1);
+      for (int v : V_i) {
+        if (R_i[C_i[v]])
+          C_i_next[v] = C_i[v];
       }
+      // Now we process each vertex in V_i, not belonging to any sampled
+      // cluster, against the graph of the start of the iteration.
+      decide(g, V_i, C_i,
+          [&] (int v) { return is_vertex_sampled(R_i, C_i, v); }, C_i_next,
+          state);
+      add_buffers(state.buffers, spanner);
+      // Now we need to remove the dropped and the intra cluster edges.
+      drop_edges(g, V_i, C_i, C_i_next, state.drops);
+      // V_{i+1} is the vertices of V_i that are clustered in C_{i+1}, which
+      // keeps it sorted. The others have no edges any more.
+      V_i_next.clear();
+      std::copy_if(std::begin(V_i), std::end(V_i),
+          std::back_inserter(V_i_next),
+          [&] (int v) { return C_i_next[v] != -1; });
       C_before_last = std::move(C_i);
       C_i = std::move(C_i_next);
-      V_i = std::move(V_i_next);
+      std::swap(V_i, V_i_next);
     }
-  return form_cluster2_ret {C_i, C_before_last, g, V_i};
+  return form_cluster2_ret {std::move(C_i), std::move(C_before_last),
+    std::move(g), std::move(V_i)};
 }
 
 
-// maps <c1, c2> -> edge, s.t edge is the minimum edge between c1 and c2
-// in 'remaining'.
-auto cluster_pair_maps(const Graph& remaining,
-    const std::unordered_set<int>& remaining_vertices,
-    const std::unordered_map<int,int>& c1,
-    const std::unordered_map<int,int>& c2) {
-  std::unordered_map<int, std::unordered_map<int, ExtendedEdge>> map;
-  for (int vertex : remaining_vertices) {
-    int v_cluster = c1.find(vertex)->second;
-    for (const auto& edge : remaining.neighbors(vertex)) {
-      // If this edge exists edge.end must be in a cluster.
-      int neighbor_cluster = c2.find(edge.end)->second;
-      // this is bit hacky, to make sure we are symmetric.
-      auto& neighbor_entry_a = map[v_cluster][neighbor_cluster];
-        auto& neighbor_entry_b = map[neighbor_cluster][v_cluster];
-        if (edge.w < neighbor_entry_a.w) {
-          neighbor_entry_a.v = vertex;
-          neighbor_entry_a.u = edge.end;
-          neighbor_entry_a.w = edge.w;
-          neighbor_entry_b = neighbor_entry_a;
-        }
-      }
+  // An edge of 'remaining' tagged with the pair of clusters it joins, packed
+  // as min * |C| + max of their dense ids.
+  struct ClusterPairEdge {
+    uint64_t pair;
+    ExtendedEdge edge;
+  };
+
+  // Orders edges, whose ends are ordered, by weight and then by their ends,
+  // so the lightest edge between two clusters is unique.
+  bool lighter(const ExtendedEdge& a, const ExtendedEdge& b) {
+    return std::tie(a.w, a.u, a.v) < std::tie(b.w, b.u, b.v);
+  }
+
+  // The dense table is used if it has at most this many cells, counting a
+  // table per thread.
+  constexpr uint64_t kMaxDenseCells = 1 << 20;
+
+  // Adds to 'spanner' the lightest edge between every pair of clusters that
+  // 'remaining' connects, where an edge (v, u) from a remaining vertex v
+  // joins v's cluster in c1 to u's cluster in c2. The clusters get dense ids
+  // and the threads tag the edges of their vertices with the pairs. With few
+  // clusters each thread keeps the lightest edge of every pair in a |C| x |C|
+  // table, and the tables are reduced cell by cell. Otherwise the tagged
+  // edges are radix sorted by pair and every run of a pair is reduced to its
+  // lightest edge. Either way the edges are added in the order of the pairs,
+  // whatever the number of threads.
+  void join_cluster_pairs(const Graph& remaining, Graph& spanner,
+      const vector<int>& vertices, const Clusters& c1, const Clusters& c2,
+      int hub_degree_threshold) {
+    const int n = remaining.size();
+    vector<int> id(n, -1);
+    for (const auto* clustering : {&c1, &c2})
+      for (int center : *clustering)
+        if (center != -1)
+          id[center] = 0;
+    uint64_t num_clusters = 0;
+    for (int center = 0; center < n; ++center)
+      if (id[center] == 0)
+        id[center] = num_clusters++;
+    // The hubs' edges are split across tasks, see VertexTasks.
+    VertexTasks tasks;
+    tasks.split(remaining, vertices, hub_degree_threshold,
+        [] (int) { return true; });
+    auto for_each_pair = [&] (int task, auto&& f) {
+      tasks.for_each_edge(remaining, vertices, tasks.tasks()[task],
+          [&] (int vertex, const Edge& edge) {
+        // If this edge exists edge.end must be in a cluster.
+        const int v_cluster = id[c1[vertex]];
+        const int u_cluster = id[c2[edge.end]];
+        f(std::min(v_cluster, u_cluster) * num_clusters +
+            std::max(v_cluster, u_cluster),
+          ExtendedEdge(std::min(vertex, edge.end), std::max(vertex, edge.end),
+            edge.w));
+      });
+    };
+    auto min_edge = [] (ExtendedEdge& current, const ExtendedEdge& e) {
+      if (current.u == -1 || lighter(e, current))
+        current = e;
+    };
+
+    const int threads = util::num_threads();
+    const uint64_t cells = num_clusters * num_clusters;
+    if (cells * threads <= kMaxDenseCells) {
+      vector<vector<ExtendedEdge>> tables(threads);
+      util::parallel_for(0, tasks.tasks().size(), [&] (int worker, int t) {
+        auto& table = tables[worker];
+        if (table.empty())
+          table.resize(cells);
+        for_each_pair(t, [&] (uint64_t pair, const ExtendedEdge& e) {
+          min_edge(table[pair], e);
+        });
+      });
+      vector<ExtendedEdge> best(cells);
+      util::parallel_for(0, cells, [&] (int, int cell) {
+        for (const auto& table : tables)
+          if (!table.empty() && table[cell].u != -1)
+            min_edge(best[cell], table[cell]);
+      }, 1024);
+      for (const auto& e : best)
+        if (e.u != -1)
+          spanner.add_edge(e.u, e.v, e.w);
+      return;
     }
-    return map;
+
+    vector<vector<ClusterPairEdge>> found(threads);
+    util::parallel_for(0, tasks.tasks().size(), [&] (int worker, int t) {
+      for_each_pair(t, [&] (uint64_t pair, const ExtendedEdge& e) {
+        found[worker].push_back({pair, e});
+      });
+    });
+    vector<size_t> offsets(threads + 1, 0);
+    for (int worker = 0; worker < threads; ++worker)
+      offsets[worker + 1] = offsets[worker] + found[worker].size();
+    vector<ClusterPairEdge> edges(offsets.back());
+    util::parallel_for(0, threads, [&] (int, int worker) {
+      std::copy(std::begin(found[worker]), std::end(found[worker]),
+          std::begin(edges) + offsets[worker]);
+      found[worker] = vector<ClusterPairEdge>();
+    });
+    int bits = 0;
+    while (bits < 64 && (cells - 1) >> bits)
+      ++bits;
+    util::parallel_radix_sort(edges,
+        [] (const ClusterPairEdge& e) { return e.pair; }, bits);
+
+    // Every slice reduces the runs that start in it.
+    const long m = edges.size();
+    const int slices = threads;
+    vector<vector<ExtendedEdge>> lightest(slices);
+    util::parallel_for(0, slices, [&] (int, int slice) {
+      long i = m * slice / slices;
+      const long end = m * (slice + 1) / slices;
+      while (i > 0 && i < end && edges[i].pair == edges[i - 1].pair)
+        ++i;
+      while (i < end) {
+        ExtendedEdge best = edges[i].edge;
+        long j = i + 1;
+        for (; j < m && edges[j].pair == edges[i].pair; ++j)
+          min_edge(best, edges[j].edge);
+        lightest[slice].push_back(best);
+        i = j;
+      }
+    });
+    for (const auto& slice : lightest)
+      for (const auto& e : slice)
+        spanner.add_edge(e.u, e.v, e.w);
   }
 
   auto join_clusters_odd(const Graph& remaining, Graph& spanner,
-      const unordered_set<int>& remaining_vertices,
-      const std::unordered_map<int, int>& clustering) {
-    auto cluster_pairs_map = cluster_pair_maps(remaining, remaining_vertices,
-        clustering, clustering);
-    for(const auto& c1 : cluster_pairs_map) {
-       for (const auto& c2 : c1.second) {
-          spanner.add_edge(c2.second.u, c2.second.v, c2.second.w);
-       }
-    }
+      const vector<int>& remaining_vertices, const Clusters& clustering,
+      int hub_degree_threshold) {
+    join_cluster_pairs(remaining, spanner, remaining_vertices, clustering,
+        clustering, hub_degree_threshold);
   }
 
   auto join_clusters_even(const Graph& remaining, Graph& spanner,
-      const std::unordered_set<int>& remaining_vertices,
-      const std::unordered_map<int, int>& last_clustering,
-      const std::unordered_map<int, int>& before_last_clustering) {
-
-    auto cluster_pairs_map = cluster_pair_maps(remaining, remaining_vertices,
-        last_clustering, before_last_clustering);
-    for(const auto& c1 : cluster_pairs_map) {
-       for (const auto& c2 : c1.second) {
-          spanner.add_edge(c2.second.u, c2.second.v, c2.second.w);
-       }
-    }
+      const vector<int>& remaining_vertices, const Clusters& last_clustering,
+      const Clusters& before_last_clustering, int hub_degree_threshold) {
+    join_cluster_pairs(remaining, spanner, remaining_vertices, last_clustering,
+        before_last_clustering, hub_degree_threshold);
   }
 } // namespace
 
@@ -547,16 +923,20 @@ Graph two_k_minus_1_spanner(int k, Graph g, std::ostream& out) {
   Graph spanner(g.size());
   bool use_rewrite = util::get_bool_flag("use_new_alg");
   if (use_rewrite) {
-    auto end_of_phase_1 = form_clusters_2(g, spanner, k, k/2);
+    vector<ClusterToMinEdge> cluster_min_edge_maps;
+    const int hub_degree_threshold =
+      util::get_int_flag("hub_degree_threshold");
+    auto end_of_phase_1 = form_clusters_2(g, spanner, k, k/2,
+        cluster_min_edge_maps, hub_degree_threshold);
     if (k % 2 == 0) {
       join_clusters_even(end_of_phase_1.not_added, spanner,
           end_of_phase_1.remaining_vertices,
           end_of_phase_1.last_clustering,
-          end_of_phase_1.before_last);
+          end_of_phase_1.before_last, hub_degree_threshold);
     } else {  // k is odd
       join_clusters_odd(end_of_phase_1.not_added, spanner,
           end_of_phase_1.remaining_vertices,
-          end_of_phase_1.last_clustering);
+          end_of_phase_1.last_clustering, hub_degree_threshold);
     }
 
   } else {
@@ -571,26 +951,104 @@ Graph two_k_minus_1_spanner(int k, Graph g, std::ostream& out) {
 }
 
 namespace {
-  void join_clusters_2(Graph not_added, Graph& spanner,
-      const std::unordered_set<int>& remaining_vertices,
-      const std::unordered_map<int, int>& clustering) {
-    for (auto v : remaining_vertices) {
-      auto min_edges = cluster_to_min_edge_map(not_added, v, clustering);
-      not_added.clear_neighbors(v);
-      for (auto&& cluster_edge : min_edges) {
-        spanner.add_edge(v, cluster_edge.second.end, cluster_edge.second.w);
+  // Adds the lightest edge from every remaining vertex v to each cluster it
+  // has an edge to, among its edges to the remaining vertices after it, so
+  // that every edge is looked at from one of its ends. remaining_vertices is
+  // sorted and holds every vertex that still has edges, so these are the
+  // neighbors above v. The vertices are independent and run in parallel,
+  // with the hubs' edges split across tasks as in decide().
+  template<typename Spanner>
+  void join_clusters_2(const Graph& not_added, Spanner& spanner,
+      const vector<int>& remaining_vertices, const Clusters& clustering,
+      vector<ClusterToMinEdge>& min_edges, int hub_degree_threshold) {
+    VertexTasks tasks;
+    tasks.split(not_added, remaining_vertices, hub_degree_threshold,
+        [] (int) { return true; });
+    HubMinEdges hub_min_edges;
+    hub_min_edges.start(tasks);
+    min_edges.resize(util::num_threads());
+    vector<EdgeBuffer> buffers(util::num_threads());
+    util::parallel_for(0, tasks.tasks().size(), [&] (int worker, int t) {
+      const auto& task = tasks.tasks()[t];
+      auto& lightest = min_edges[worker];
+      lightest.grow(not_added.size(), Edge{-1, 0});
+      if (task.hub != -1) {
+        const int hub = task.hub;
+        hub_min_edges.scan(not_added, task, clustering,
+            [hub] (const Edge& e) { return e.end > hub; }, lightest);
+        return;
+      }
+      for (size_t i = task.first; i < task.last; ++i) {
+        const int v = remaining_vertices[i];
+        if (tasks.is_hub(v))
+          continue;
+        lightest.clear();
+        for (const auto& e : not_added.neighbors(v))
+          if (e.end > v)
+            lightest.min(clustering[e.end], e);
+        for (int cluster : lightest.keys())
+          buffers[worker].emplace_back(v, lightest[cluster].end,
+              lightest[cluster].w);
       }
+    });
+    hub_min_edges.reduce(not_added, tasks, min_edges);
+    add_buffers(buffers, spanner);
+    for (size_t i = 0; i < tasks.hubs().size(); ++i) {
+      const int hub = tasks.hubs()[i];
+      hub_min_edges.for_each_min_edge(i, [&] (int, const Edge& e) {
+        spanner.add_edge(hub, e.end, e.w);
+      });
     }
   }
 }  // namespace
 
-Graph two_k_minus_1_spannerv2(int k, Graph g) {
-   Graph spanner(g.size()); 
-   auto end_of_phase_1 = form_clusters_2(g, spanner, k, k-1);
+namespace {
+  template<typename Spanner>
+  void two_k_minus_1_spannerv2(int k, Graph g, Spanner& spanner,
+      vector<ClusterToMinEdge>& cluster_min_edge_maps,
+      int hub_degree_threshold, ClusterHierarchy* hierarchy) {
+   auto end_of_phase_1 = form_clusters_2(std::move(g), spanner, k, k-1,
+       cluster_min_edge_maps, hub_degree_threshold, hierarchy);
    join_clusters_2(end_of_phase_1.not_added, spanner,
-       end_of_phase_1.remaining_vertices, end_of_phase_1.last_clustering);
+       end_of_phase_1.remaining_vertices, end_of_phase_1.last_clustering,
+       cluster_min_edge_maps, hub_degree_threshold);
+  }
+}  // namespace
+
+Graph two_k_minus_1_spannerv2(int k, Graph g, ClusterHierarchy* hierarchy) {
+   Graph spanner(g.size()); 
+   vector<ClusterToMinEdge> cluster_min_edge_maps;
+   two_k_minus_1_spannerv2(k, std::move(g), spanner, cluster_min_edge_maps,
+       util::get_int_flag("hub_degree_threshold"), hierarchy);
    return spanner;
 }
+
+std::vector<ExtendedEdge> two_k_minus_1_spannerv2_edges(int k, Graph g,
+    ClusterHierarchy* hierarchy) {
+   EdgeList spanner;
+   vector<ClusterToMinEdge> cluster_min_edge_maps;
+   two_k_minus_1_spannerv2(k, std::move(g), spanner, cluster_min_edge_maps,
+       util::get_int_flag("hub_degree_threshold"), hierarchy);
+   sort_and_dedup_edges(spanner.edges);
+   return std::move(spanner.edges);
+}
+
+std::vector<std::vector<ExtendedEdge>> two_k_minus_1_spannerv2_batch(int k,
+    const std::vector<Graph>& graphs) {
+  std::vector<std::vector<ExtendedEdge>> spanners(graphs.size());
+  std::vector<std::vector<ClusterToMinEdge>> scratch(util::num_threads());
+  std::vector<EdgeList> buffers(util::num_threads());
+  const int hub_degree_threshold = util::get_int_flag("hub_degree_threshold");
+  util::parallel_for(0, graphs.size(), [&] (int worker, int i) {
+    auto& spanner = buffers[worker];
+    spanner.edges.clear();
+    two_k_minus_1_spannerv2(k, graphs[i], spanner, scratch[worker],
+        hub_degree_threshold, nullptr);
+    sort_and_dedup_edges(spanner.edges);
+    spanners[i] = spanner.edges;
+  });
+  return spanners;
+}
     
 
 }  // namespace graphs
@@ -6,11 +6,28 @@ namespace graphs {
 
   // This is the algorithm described in the article.
   Graph two_k_minus_1_spanner(int k, Graph g, std::ostream& out = std::cout);
+  // The centers of the nested clusterings the first phase goes through:
+  // centers[0] holds every vertex (the singleton clusters) and centers[i + 1]
+  // the centers of the clusters sampled in iteration i, sorted.
+  struct ClusterHierarchy {
+    std::vector<std::vector<int>> centers;
+  };
+
   // This is the algorithm described in
   // https://u.cs.biu.ac.il/~liamr/spanner.pdf
   // Which does k-1 iterations of the firt phase and a simpler joining of
-  // clusters.
-  Graph two_k_minus_1_spannerv2(int k, Graph g);
+  // clusters. If 'hierarchy' isn't null it gets the k levels of centers
+  // sampled on the way.
+  Graph two_k_minus_1_spannerv2(int k, Graph g,
+      ClusterHierarchy* hierarchy = nullptr);
+  // The same spanner as a list of edges (u, v) with u <= v, sorted and
+  // without duplicates, which is much cheaper to build than a Graph.
+  std::vector<ExtendedEdge> two_k_minus_1_spannerv2_edges(int k, Graph g,
+      ClusterHierarchy* hierarchy = nullptr);
+  // The spanners (as edge lists) of many graphs, spread over the threads,
+  // each of which reuses its buffers from one graph to the next.
+  std::vector<std::vector<ExtendedEdge>> two_k_minus_1_spannerv2_batch(int k,
+      const std::vector<Graph>& graphs);
 
 }  // namespace graphs.
 #endif
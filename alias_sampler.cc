@@ -0,0 +1,108 @@
+#include "alias_sampler.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <sstream>
+
+namespace util {
+AliasSampler::AliasSampler(std::vector<double> vals,
+    const std::vector<double>& weights):
+  values(std::move(vals)), probability(values.size()), alias(values.size()) {
+  assert(!values.empty() && values.size() == weights.size());
+  for (size_t i = 0; i < weights.size(); ++i) {
+    if (!std::isfinite(values[i]) || !std::isfinite(weights[i]) ||
+        weights[i] < 0) {
+      std::cout << "Invalid weight " << weights[i] << " of value " << values[i]
+        << ", values must be finite and weights finite and non-negative"
+        << std::endl;
+      assert(false);
+    }
+  }
+  const double total = std::accumulate(std::begin(weights), std::end(weights),
+      0.0);
+  if (!(total > 0) || !std::isfinite(total)) {
+    std::cout << "Weights must have a positive finite sum, got " << total
+      << std::endl;
+    assert(false);
+  }
+  // Scale the weights so the average slot holds exactly 1, then pair every
+  // slot holding less than 1 with one holding more than 1.
+  std::vector<uint32_t> small, large;
+  for (size_t i = 0; i < weights.size(); ++i) {
+    probability[i] = weights[i] * size() / total;
+    alias[i] = i;
+    (probability[i] < 1.0 ? small : large).push_back(i);
+  }
+  while (!small.empty() && !large.empty()) {
+    auto less = small.back();
+    auto more = large.back();
+    small.pop_back();
+    alias[less] = more;
+    probability[more] -= 1.0 - probability[less];
+    if (probability[more] < 1.0) {
+      large.pop_back();
+      small.push_back(more);
+    }
+  }
+  // Whatever is left is 1 up to rounding errors.
+  for (auto i : small)
+    probability[i] = 1.0;
+  for (auto i : large)
+    probability[i] = 1.0;
+}
+
+AliasSampler AliasSampler::FromFile(const std::string& path) {
+  std::ifstream in(path);
+  if (!in) {
+    std::cout << "Could not open weights file " << path << std::endl;
+    assert(false);
+  }
+  // Identical values are merged so a sample file turns into a histogram.
+  std::map<double, double> histogram;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    double value, weight = 1.0;
+    if (!(fields >> value))
+      continue;  // Empty line.
+    if ((!(fields >> weight) && !fields.eof()) || !std::isfinite(value) ||
+        !std::isfinite(weight) || weight < 0) {
+      std::cout << "Invalid line \"" << line << "\" in weights file " << path
+        << ", weights must be finite and non-negative" << std::endl;
+      assert(false);
+    }
+    histogram[value] += weight;
+  }
+  std::vector<double> values, weights;
+  for (const auto& bin : histogram) {
+    values.push_back(bin.first);
+    weights.push_back(bin.second);
+  }
+  if (values.empty()) {
+    std::cout << "Weights file " << path << " has no weights" << std::endl;
+    assert(false);
+  }
+  if (std::all_of(std::begin(weights), std::end(weights),
+        [] (double weight) { return weight == 0; })) {
+    std::cout << "All the weights of weights file " << path << " are 0"
+      << std::endl;
+    assert(false);
+  }
+  return AliasSampler(std::move(values), weights);
+}
+
+void AliasSampler::fill(RandomEngine& generator, double* first,
+    double* last) const {
+  std::uniform_real_distribution<double> uniform(0, size());
+  const auto last_slot = size() - 1;
+  for (; first != last; ++first) {
+    double u = uniform(generator);
+    auto slot = std::min(static_cast<size_t>(u), last_slot);
+    *first = (u - slot) < probability[slot] ? values[slot] :
+      values[alias[slot]];
+  }
+}
+}  // namespace util
@@ -0,0 +1,45 @@
+#ifndef ALIAS_SAMPLER_H
+#define ALIAS_SAMPLER_H
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "util.h"
+
+namespace util {
+  // Samples values of a discrete distribution in O(1) per draw using Walker's
+  // alias method. Every slot i of the table holds values[i] with probability
+  // probability[i] and values[alias[i]] otherwise, so a draw is one uniform
+  // number, one table lookup and one comparison.
+  class AliasSampler {
+    public:
+      // 'weights' are the (not necessarily normalized) weights of 'values'.
+      // The values and the weights must be finite, and the weights
+      // non-negative with a positive sum.
+      AliasSampler(std::vector<double> values,
+          const std::vector<double>& weights);
+
+      // Loads an empirical distribution from 'path'. Each line is either a
+      // single value, i.e the file is a sample of weights, or a pair
+      // "value weight", i.e the file is a histogram.
+      static AliasSampler FromFile(const std::string& path);
+
+      double operator()(RandomEngine& generator) const {
+        double u = std::uniform_real_distribution<double>(0, size())(generator);
+        auto slot = std::min(static_cast<size_t>(u), size() - 1);
+        return (u - slot) < probability[slot] ? values[slot] :
+          values[alias[slot]];
+      }
+
+      // Fills [first, last) with independent draws.
+      void fill(RandomEngine& generator, double* first, double* last) const;
+
+      size_t size() const { return values.size(); }
+
+    private:
+      std::vector<double> values;
+      std::vector<double> probability;
+      std::vector<uint32_t> alias;
+  };
+}  // namespace util.
+#endif
@@ -0,0 +1,341 @@
+#include "contraction_hierarchy.h"
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <memory>
+#include "shortest_paths.h"
+#include "util.h"
+
+namespace graphs {
+namespace {
+  // A witness search gives up (and keeps the shortcut) once it settled this
+  // many vertices. Extra shortcuts only cost query time, never correctness.
+  constexpr int kWitnessSettleLimit = 64;
+
+  // The graph of the vertices not contracted yet.
+  struct Overlay {
+    std::vector<std::vector<Edge>> adjacency;
+    const std::vector<Edge>& neighbors(int v) const { return adjacency[v]; }
+
+    // Adds the edge (u, v), or lowers its weight if it is already there.
+    // Returns true if the edge is new.
+    bool add_edge(int u, int v, double w) {
+      for (int side = 0; side < 2; ++side, std::swap(u, v)) {
+        auto& edges = adjacency[u];
+        auto existing = std::find_if(std::begin(edges), std::end(edges),
+            [v] (const Edge& e) { return e.end == v; });
+        if (existing == std::end(edges)) {
+          edges.emplace_back(v, w);
+        } else if (w < existing->w) {
+          existing->w = w;
+        } else {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    void remove_edge(int u, int v) {
+      auto& edges = adjacency[u];
+      auto e = std::find_if(std::begin(edges), std::end(edges),
+          [v] (const Edge& e) { return e.end == v; });
+      *e = edges.back();
+      edges.pop_back();
+    }
+  };
+
+  struct Shortcut {
+    int u;
+    int v;
+    double w;
+  };
+
+  // Per thread state of the witness searches.
+  struct Witness {
+    DijkstraSearch search;
+    std::vector<char> is_target;
+    explicit Witness(int n): search(n), is_target(n, 0) {}
+  };
+
+  // Appends to 'shortcuts' the edges (u, w) between neighbors of v that
+  // contracting v needs: those whose path through v has no witness path of
+  // at most the same length that avoids v and the excluded vertices. Gives up
+  // once it found more than 'limit' of them.
+  void find_shortcuts(const Overlay& overlay, int v,
+      const std::vector<char>& excluded, Witness& witness,
+      std::vector<Shortcut>& shortcuts,
+      size_t limit = std::numeric_limits<size_t>::max()) {
+    const auto& neighbors = overlay.neighbors(v);
+    double max_weight = 0;
+    for (const auto& e : neighbors)
+      max_weight = std::max(max_weight, e.w);
+    for (size_t i = 0; i + 1 < neighbors.size() && shortcuts.size() <= limit;
+        ++i) {
+      const auto& from = neighbors[i];
+      const double bound = from.w + max_weight;
+      size_t targets = neighbors.size() - i - 1;
+      for (size_t j = i + 1; j < neighbors.size(); ++j)
+        witness.is_target[neighbors[j].end] = 1;
+      int settled = 0;
+      witness.search.run_pruned(overlay, from.end,
+          [&] (int u, double d) {
+            return u != v && !excluded[u] && d <= bound;
+          },
+          [&] (int u, double) {
+            if (witness.is_target[u])
+              --targets;
+            return targets > 0 && ++settled < kWitnessSettleLimit;
+          });
+      // A reached vertex' tentative distance is the length of a real path,
+      // so it is a witness even if the search stopped before settling it.
+      for (size_t j = i + 1; j < neighbors.size(); ++j) {
+        const auto& to = neighbors[j];
+        witness.is_target[to.end] = 0;
+        if (witness.search.distance(to.end) > from.w + to.w)
+          shortcuts.push_back({from.end, to.end, from.w + to.w});
+      }
+    }
+  }
+
+  // A vertex whose contraction would add more than this many shortcuts per
+  // edge it removes stays in the core. In expander-like graphs (e.g spanners
+  // of random graphs) contracting a vertex adds about degree^2 / 2 shortcuts,
+  // and going on would only make a denser core.
+  constexpr double kMaxShortcutsPerEdge = 2.0;
+
+  // Breaks ties between equal priorities without favoring low ids.
+  unsigned tie_break(int v) { return unsigned(v) * 2654435761u; }
+}  // namespace
+
+ContractionHierarchy::ContractionHierarchy(const Graph& g) {
+  const int n = g.size();
+  Overlay overlay;
+  overlay.adjacency.resize(n);
+  for (int v = 0; v < n; ++v)
+    for (const auto& e : g.neighbors(v))
+      if (e.end != v)
+        overlay.adjacency[v].push_back(e);
+
+  std::vector<std::vector<Edge>> up(n);
+  std::vector<char> excluded(n, 0);
+  std::vector<int> contracted_neighbors(n, 0);
+  std::vector<double> priority(n);
+  std::vector<char> eligible(n);
+  std::vector<Witness> witnesses(util::num_threads(), Witness(n));
+  std::vector<std::vector<Shortcut>> found(util::num_threads());
+  auto update_priorities = [&] (const std::vector<int>& vertices) {
+    util::parallel_for(0, vertices.size(), [&] (int worker, int i) {
+      const int v = vertices[i];
+      auto& shortcuts = found[worker];
+      shortcuts.clear();
+      const double degree = overlay.neighbors(v).size();
+      find_shortcuts(overlay, v, excluded, witnesses[worker], shortcuts,
+          kMaxShortcutsPerEdge * degree);
+      priority[v] = shortcuts.size() - degree + contracted_neighbors[v];
+      eligible[v] = shortcuts.size() <= kMaxShortcutsPerEdge * degree;
+    }, 16);
+  };
+
+  std::vector<int> remaining(n);
+  for (int v = 0; v < n; ++v)
+    remaining[v] = v;
+  update_priorities(remaining);
+  std::vector<char> in_round(n, 0);
+  std::vector<int> round, touched;
+  while (true) {
+    // The eligible vertices whose priority is lower than their eligible
+    // neighbors', an independent set.
+    round.clear();
+    for (int v : remaining) {
+      if (!eligible[v])
+        continue;
+      const auto key = std::make_pair(priority[v], tie_break(v));
+      const auto& neighbors = overlay.neighbors(v);
+      if (std::all_of(std::begin(neighbors), std::end(neighbors),
+            [&] (const Edge& e) {
+              return !eligible[e.end] ||
+                key < std::make_pair(priority[e.end], tie_break(e.end));
+            })) {
+        round.push_back(v);
+      }
+    }
+    if (round.empty())
+      break;
+    for (int v : round)
+      excluded[v] = in_round[v] = 1;
+    for (auto& shortcuts : found)
+      shortcuts.clear();
+    util::parallel_for(0, round.size(), [&] (int worker, int i) {
+      find_shortcuts(overlay, round[i], excluded, witnesses[worker],
+          found[worker]);
+    }, 16);
+
+    touched.clear();
+    for (int v : round) {
+      for (const auto& e : overlay.neighbors(v)) {
+        up[v].push_back(e);
+        overlay.remove_edge(e.end, v);
+        ++contracted_neighbors[e.end];
+        touched.push_back(e.end);
+      }
+      overlay.adjacency[v].clear();
+      overlay.adjacency[v].shrink_to_fit();
+    }
+    for (const auto& shortcuts : found) {
+      for (const auto& s : shortcuts) {
+        num_shortcuts += overlay.add_edge(s.u, s.v, s.w);
+      }
+    }
+    std::sort(std::begin(touched), std::end(touched));
+    touched.erase(std::unique(std::begin(touched), std::end(touched)),
+        std::end(touched));
+    remaining.erase(std::remove_if(std::begin(remaining), std::end(remaining),
+          [&] (int v) { return in_round[v]; }), std::end(remaining));
+    update_priorities(touched);
+  }
+
+  // The core keeps its edges in both directions.
+  core.assign(n, 0);
+  for (int v : remaining) {
+    up[v] = overlay.neighbors(v);
+    core[v] = 1;
+  }
+
+  std::vector<long> offsets(n + 1, 0);
+  std::vector<Edge> adjacency;
+  for (int v = 0; v < n; ++v) {
+    offsets[v + 1] = offsets[v] + up[v].size();
+    adjacency.insert(std::end(adjacency), std::begin(up[v]), std::end(up[v]));
+  }
+  upward = CsrGraph(std::move(offsets), std::move(adjacency));
+}
+
+namespace {
+  // A query first searches up from both ends without entering the core: the
+  // searches are small and exhaustive, and a shortest path that avoids the
+  // core is found at its top vertex, which both of them settle. Otherwise it
+  // goes up from s into the core, through the core and down to t, so the
+  // core vertices the two searches reached (with their distances) seed a
+  // plain bidirectional Dijkstra in the core, which is undirected.
+  class QuerySearch {
+    public:
+      explicit QuerySearch(int n) {
+        for (auto& side : sides)
+          side.dist.assign(n, std::numeric_limits<double>::infinity());
+      }
+
+      int size() const { return sides[0].dist.size(); }
+
+      double distance(const CsrGraph& upward, const std::vector<char>& core,
+          int s, int t) {
+        const double inf = std::numeric_limits<double>::infinity();
+        auto& forward = sides[0];
+        auto& backward = sides[1];
+        forward.start(s);
+        backward.start(t);
+        for (auto& side : sides) {
+          side.entries.clear();
+          while (!side.heap.empty()) {
+            const auto top = side.pop();
+            if (top.first > side.dist[top.second])
+              continue;
+            if (core[top.second]) {
+              side.entries.push_back(top.second);
+              continue;
+            }
+            for (const auto& e : upward.neighbors(top.second))
+              side.relax(e.end, top.first + e.w);
+          }
+        }
+        double best = inf;
+        for (int v : forward.touched)
+          best = std::min(best, forward.dist[v] + backward.dist[v]);
+
+        for (auto& side : sides) {
+          for (int v : side.entries)
+            side.heap.emplace_back(side.dist[v], v);
+          std::make_heap(std::begin(side.heap), std::end(side.heap),
+              std::greater<Entry>());
+        }
+        while (true) {
+          const double top_f = forward.heap.empty() ? inf :
+            forward.heap.front().first;
+          const double top_b = backward.heap.empty() ? inf :
+            backward.heap.front().first;
+          if (std::min(top_f, top_b) >= best || top_f + top_b >= best)
+            return best;
+          const int i = top_f <= top_b ? 0 : 1;
+          auto& side = sides[i];
+          const auto& other = sides[1 - i];
+          const auto top = side.pop();
+          if (top.first > side.dist[top.second])
+            continue;
+          best = std::min(best, top.first + other.dist[top.second]);
+          for (const auto& e : upward.neighbors(top.second))
+            side.relax(e.end, top.first + e.w);
+        }
+      }
+
+    private:
+      using Entry = std::pair<double, int>;
+
+      struct Side {
+        std::vector<double> dist;
+        std::vector<int> touched;
+        std::vector<Entry> heap;
+        // The core vertices reached from outside of the core.
+        std::vector<int> entries;
+
+        void start(int src) {
+          for (int v : touched)
+            dist[v] = std::numeric_limits<double>::infinity();
+          touched.clear();
+          heap.clear();
+          relax(src, 0);
+        }
+
+        void relax(int v, double d) {
+          if (d < dist[v]) {
+            if (dist[v] == std::numeric_limits<double>::infinity())
+              touched.push_back(v);
+            dist[v] = d;
+            heap.emplace_back(d, v);
+            std::push_heap(std::begin(heap), std::end(heap),
+                std::greater<Entry>());
+          }
+        }
+
+        Entry pop() {
+          std::pop_heap(std::begin(heap), std::end(heap), std::greater<Entry>());
+          const auto top = heap.back();
+          heap.pop_back();
+          return top;
+        }
+      };
+
+      Side sides[2];
+  };
+}  // namespace
+
+int ContractionHierarchy::core_size() const {
+  return std::count(std::begin(core), std::end(core), 1);
+}
+
+double ContractionHierarchy::distance(int s, int t) const {
+  thread_local std::unique_ptr<QuerySearch> search;
+  if (!search || search->size() != size())
+    search.reset(new QuerySearch(size()));
+  return search->distance(upward, core, s, t);
+}
+
+std::vector<double> ContractionHierarchy::distances(
+    const std::vector<std::pair<int, int>>& queries) const {
+  std::vector<double> result(queries.size());
+  std::vector<QuerySearch> searches(util::num_threads(), QuerySearch(size()));
+  util::parallel_for(0, queries.size(), [&] (int worker, int q) {
+    result[q] = searches[worker].distance(upward, core, queries[q].first,
+        queries[q].second);
+  }, 256);
+  return result;
+}
+}  // namespace graphs
@@ -0,0 +1,49 @@
+#ifndef CONTRACTION_HIERARCHY_H
+#define CONTRACTION_HIERARCHY_H
+#include <utility>
+#include <vector>
+#include "csr_graph.h"
+#include "graph.h"
+
+namespace graphs {
+  // A contraction hierarchy of a graph (typically a sparse spanner), answering
+  // exact point to point distances with two small searches.
+  //
+  // The vertices are contracted one independent set at a time: a vertex is
+  // contracted in a round if its priority (the shortcuts its contraction adds
+  // minus its degree, plus the number of its contracted neighbors) is lower
+  // than its remaining neighbors'. The vertices of a round look for their
+  // shortcuts in parallel, with witness searches that avoid all of them.
+  // Vertices whose contraction adds too many shortcuts are left in an
+  // uncontracted core. Every vertex keeps its edges to the vertices
+  // contracted after it (or, in the core, to its core neighbors), and a query
+  // meets in the middle of the upward searches from its two ends, with a
+  // bidirectional Dijkstra over the core if the path goes through it.
+  //
+  // Random graphs and their spanners are expanders, most of their vertices
+  // stay in the core, and queries there are only a few times faster than
+  // Dijkstra.
+  class ContractionHierarchy {
+    public:
+      explicit ContractionHierarchy(const Graph& g);
+
+      int size() const { return upward.size(); }
+      // Number of shortcut edges added by the contraction.
+      long shortcuts() const { return num_shortcuts; }
+      // Number of vertices left uncontracted.
+      int core_size() const;
+
+      // d(s, t) in the graph, infinity if they are disconnected. Keeps the
+      // search state per thread, so calls cost only their search spaces.
+      double distance(int s, int t) const;
+      // d(s, t) of every query, answered in parallel.
+      std::vector<double> distances(
+          const std::vector<std::pair<int, int>>& queries) const;
+
+    private:
+      CsrGraph upward;
+      std::vector<char> core;
+      long num_shortcuts = 0;
+  };
+}  // namespace graphs
+#endif
@@ -0,0 +1,74 @@
+#include "coupled_graphs.h"
+#include <cassert>
+#include <random>
+
+namespace graphs {
+namespace {
+  unsigned long seed_or_random(long long seed) {
+    return seed >= 0 ? static_cast<unsigned long>(seed) :
+      std::random_device{}();
+  }
+}  // namespace
+
+CoupledGraphs::CoupledGraphs(int max_size, double max_density,
+    int num_points, EdgeWeightSampler edge_weight, long long seed):
+  max_size(max_size), max_density(max_density), num_points(num_points),
+  edge_weight(std::move(edge_weight)), seed(seed_or_random(seed)) {}
+
+Graph CoupledGraphs::graph(int run, int size, double density) {
+  assert(size <= max_size && density <= max_density);
+  auto d = draw(run);
+  Graph result(size);
+  for (size_t i = 0; i < d->end_of[size]; ++i) {
+    const auto& e = d->edges[i];
+    if (e.coin < density) {
+      result.add_edge(e.u, e.v, e.w);
+    }
+  }
+  return result;
+}
+
+std::shared_ptr<const CoupledGraphs::Draw> CoupledGraphs::draw(int run) {
+  std::promise<std::shared_ptr<const Draw>> promise;
+  std::shared_future<std::shared_ptr<const Draw>> pending;
+  bool generate_draw = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = draws.find(run);
+    if (entry == std::end(draws)) {
+      pending = promise.get_future().share();
+      entry = draws.emplace(run, Entry{pending, 0}).first;
+      generate_draw = true;
+    }
+    pending = entry->second.draw;
+    // The last point asking for this run releases it, points that are still
+    // using it hold their own reference.
+    if (++entry->second.requests == num_points) {
+      draws.erase(entry);
+    }
+  }
+  if (generate_draw) {
+    promise.set_value(std::make_shared<const Draw>(generate(seed + run)));
+  }
+  return pending.get();
+}
+
+CoupledGraphs::Draw CoupledGraphs::generate(unsigned long run_seed) const {
+  util::RandomEngine generator(run_seed);
+  std::uniform_real_distribution<double> coin(0, 1);
+  Draw result;
+  result.end_of.assign(max_size + 1, 0);
+  for (int v = 0; v < max_size; ++v) {
+    for (int u = 0; u < v; ++u) {
+      // Pairs that are not in the densest graph are not in any graph of the
+      // sweep, so their weight is never drawn.
+      double c = coin(generator);
+      if (c < max_density) {
+        result.edges.push_back({u, v, c, edge_weight(generator)});
+      }
+    }
+    result.end_of[v + 1] = result.edges.size();
+  }
+  return result;
+}
+}  // namespace graphs
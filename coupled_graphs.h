@@ -0,0 +1,60 @@
+#ifndef COUPLED_GRAPHS_H
+#define COUPLED_GRAPHS_H
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "graph.h"
+
+namespace graphs {
+  // Generates the random graphs of a whole size or density sweep from a single
+  // draw. For every run one uniform coin and one weight are drawn per pair of
+  // vertices of the largest size, only once. The graph for a point (size,
+  // density) of the sweep is then the subgraph induced on the vertices
+  // 0 .. size-1 keeping the pairs whose coin is below density. So a sweep costs
+  // one generation pass over its largest and densest graph, and the points of
+  // a run are correlated - a denser graph contains every sparser one and a
+  // larger graph contains every smaller one.
+  class CoupledGraphs {
+    public:
+      // 'num_points' is the number of sweep points that will ask for the
+      // graphs of each run, once all of them did the draw of that run is
+      // released. Run i uses seed + i, a negative seed picks a random one.
+      CoupledGraphs(int max_size, double max_density, int num_points,
+          EdgeWeightSampler edge_weight, long long seed);
+
+      // Returns the graph of the run'th run for the sweep point
+      // (size, density), size <= max_size and density <= max_density.
+      Graph graph(int run, int size, double density);
+
+    private:
+      struct CoupledEdge {
+        int u, v;
+        double coin;
+        double w;
+      };
+      struct Draw {
+        // Edges ordered by their larger endpoint, so the edges of the graph
+        // induced on 0 .. size-1 are the prefix ending at end_of[size].
+        std::vector<CoupledEdge> edges;
+        std::vector<size_t> end_of;
+      };
+      struct Entry {
+        std::shared_future<std::shared_ptr<const Draw>> draw;
+        int requests;
+      };
+
+      std::shared_ptr<const Draw> draw(int run);
+      Draw generate(unsigned long seed) const;
+
+      const int max_size;
+      const double max_density;
+      const int num_points;
+      const EdgeWeightSampler edge_weight;
+      const unsigned long seed;
+      std::mutex mutex;
+      std::unordered_map<int, Entry> draws;
+  };
+}  // namespace graphs
+#endif
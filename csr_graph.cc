@@ -0,0 +1,34 @@
+#include "csr_graph.h"
+
+namespace graphs {
+CsrGraph::CsrGraph(const Graph& g): offsets(g.size() + 1, 0) {
+  for (int v = 0; v < g.size(); ++v) {
+    offsets[v + 1] = offsets[v] + g.neighbors(v).size();
+  }
+  adjacency.reserve(offsets.back());
+  for (int v = 0; v < g.size(); ++v) {
+    for (const auto& e : g.neighbors(v)) {
+      adjacency.push_back(e);
+    }
+  }
+}
+
+CsrGraph::CsrGraph(int n, const std::vector<ExtendedEdge>& edges):
+  offsets(n + 1, 0) {
+  for (const auto& e : edges) {
+    ++offsets[e.u + 1];
+    if (e.v != e.u)
+      ++offsets[e.v + 1];
+  }
+  for (int v = 0; v < n; ++v) {
+    offsets[v + 1] += offsets[v];
+  }
+  adjacency.assign(offsets.back(), Edge(-1, 0));
+  std::vector<long> next(std::begin(offsets), std::end(offsets) - 1);
+  for (const auto& e : edges) {
+    adjacency[next[e.u]++] = Edge(e.v, e.w);
+    if (e.v != e.u)
+      adjacency[next[e.v]++] = Edge(e.u, e.w);
+  }
+}
+}  // namespace graphs
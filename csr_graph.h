@@ -0,0 +1,52 @@
+#ifndef CSR_GRAPH_H
+#define CSR_GRAPH_H
+#include <utility>
+#include <vector>
+#include "graph.h"
+
+namespace graphs {
+  // A read only copy of a Graph in compressed sparse row form: the neighbors
+  // of every vertex lie next to each other in one array. Searches that scan
+  // many adjacency lists (all the shortest path code) run several times faster
+  // on it than on the hash sets of Graph.
+  class CsrGraph {
+    public:
+      // The neighbors of a single vertex.
+      class Neighbors {
+        public:
+          Neighbors(const Edge* first, const Edge* last):
+            first(first), last(last) {}
+          const Edge* begin() const { return first; }
+          const Edge* end() const { return last; }
+          size_t size() const { return last - first; }
+          bool empty() const { return first == last; }
+        private:
+          const Edge* first;
+          const Edge* last;
+      };
+
+      CsrGraph() : offsets(1, 0) {}
+      explicit CsrGraph(const Graph& g);
+      // The graph with n vertices and the given (undirected) edges, e.g a
+      // spanner in edge list form.
+      CsrGraph(int n, const std::vector<ExtendedEdge>& edges);
+      // The neighbors of v are adjacency[offsets[v], offsets[v + 1]). Unlike
+      // a Graph they need not be symmetric, e.g the upward edges of a
+      // contraction hierarchy.
+      CsrGraph(std::vector<long> offsets, std::vector<Edge> adjacency):
+        offsets(std::move(offsets)), adjacency(std::move(adjacency)) {}
+
+      int size() const { return offsets.size() - 1; }
+      // Like Graph::edges, every edge is counted once for each endpoint.
+      long edges() const { return adjacency.size(); }
+      Neighbors neighbors(int v) const {
+        return {adjacency.data() + offsets[v],
+          adjacency.data() + offsets[v + 1]};
+      }
+
+    private:
+      std::vector<long> offsets;
+      std::vector<Edge> adjacency;
+  };
+}  // namespace graphs
+#endif
@@ -0,0 +1,117 @@
+#include "distance_oracle.h"
+#include <functional>
+#include <limits>
+#include <utility>
+#include "csr_graph.h"
+#include "shortest_paths.h"
+#include "util.h"
+
+namespace graphs {
+namespace {
+  // Dijkstra from all of 'sources' at once, sets nearest[v] to the source
+  // closest to v and distance[v] to its distance.
+  void nearest_source(const CsrGraph& g, const std::vector<int>& sources,
+      std::vector<int>& nearest, std::vector<double>& distance) {
+    using Entry = std::pair<double, int>;
+    nearest.assign(g.size(), -1);
+    distance.assign(g.size(), std::numeric_limits<double>::infinity());
+    std::vector<Entry> heap;
+    for (int s : sources) {
+      nearest[s] = s;
+      distance[s] = 0;
+      heap.emplace_back(0, s);
+    }
+    while (!heap.empty()) {
+      std::pop_heap(std::begin(heap), std::end(heap), std::greater<Entry>());
+      const auto top = heap.back();
+      heap.pop_back();
+      if (top.first > distance[top.second])
+        continue;
+      for (const auto& e : g.neighbors(top.second)) {
+        const double d = top.first + e.w;
+        if (d < distance[e.end]) {
+          distance[e.end] = d;
+          nearest[e.end] = nearest[top.second];
+          heap.emplace_back(d, e.end);
+          std::push_heap(std::begin(heap), std::end(heap), std::greater<Entry>());
+        }
+      }
+    }
+  }
+}  // namespace
+
+DistanceOracle::DistanceOracle(const Graph& g,
+    const ClusterHierarchy& hierarchy): bunch(g.size()) {
+  const CsrGraph csr(g);
+  const int n = g.size();
+  int levels = 0;
+  while (levels < static_cast<int>(hierarchy.centers.size()) &&
+      !hierarchy.centers[levels].empty())
+    ++levels;
+  pivot.resize(levels);
+  pivot_distance.resize(levels);
+  util::parallel_for(0, levels, [&] (int, int i) {
+    nearest_source(csr, hierarchy.centers[i], pivot[i], pivot_distance[i]);
+  });
+  // The highest level every vertex is a center of.
+  std::vector<int> level(n, 0);
+  for (int i = 1; i < levels; ++i)
+    for (int w : hierarchy.centers[i])
+      level[w] = i;
+
+  // The cluster of w in A_i - A_{i+1} holds the vertices v it is closer to
+  // than A_{i+1} is, i.e the v with w in B(v). A vertex on a shortest path
+  // from w to a member of the cluster is a member too, so a search from w that
+  // drops every other vertex finds exactly the cluster.
+  struct Member {
+    int v;
+    int center;
+    double distance;
+  };
+  std::vector<DijkstraSearch> searches(util::num_threads(), DijkstraSearch(n));
+  std::vector<std::vector<Member>> members(util::num_threads());
+  util::parallel_for(0, n, [&] (int worker, int w) {
+    const int i = level[w];
+    const double* limit = i + 1 < levels ? pivot_distance[i + 1].data() :
+      nullptr;
+    searches[worker].run_pruned(csr, w,
+        [limit] (int v, double d) { return !limit || d < limit[v]; },
+        [&] (int v, double d) {
+          members[worker].push_back({v, w, d});
+          return true;
+        });
+  }, 64);
+  for (auto& worker_members : members) {
+    for (const auto& member : worker_members)
+      bunch[member.v].emplace(member.center, member.distance);
+    worker_members = std::vector<Member>();
+  }
+}
+
+double DistanceOracle::query(int u, int v) const {
+  if (levels() == 0)
+    return std::numeric_limits<double>::infinity();
+  int w = u;
+  for (int i = 0; ; ) {
+    auto in_bunch = bunch[v].find(w);
+    if (in_bunch != std::end(bunch[v]))
+      return pivot_distance[i][u] + in_bunch->second;
+    if (++i == levels())
+      break;
+    std::swap(u, v);
+    w = pivot[i][u];
+    if (w == -1)
+      break;
+  }
+  // Only disconnected pairs get here: every vertex of the top level reachable
+  // from v is in B(v).
+  return std::numeric_limits<double>::infinity();
+}
+
+long DistanceOracle::bunch_entries() const {
+  long entries = 0;
+  for (const auto& b : bunch)
+    entries += b.size();
+  return entries;
+}
+}  // namespace graphs
@@ -0,0 +1,41 @@
+#ifndef DISTANCE_ORACLE_H
+#define DISTANCE_ORACLE_H
+#include <unordered_map>
+#include <vector>
+#include "2k_spanner.h"
+#include "graph.h"
+
+namespace graphs {
+  // Thorup and Zwick's approximate distance oracle. It is built over the
+  // nested sets of centers A_0 = V, A_1, ..., A_{k-1} that the first phase of
+  // two_k_minus_1_spannerv2 samples (a level that came out empty ends the
+  // hierarchy early, which only lowers k). Every vertex v keeps
+  //  * its pivots p_i(v), the vertex of A_i nearest to v, and
+  //  * its bunch B(v), the vertices w of A_i - A_{i+1} (over all i) that are
+  //    closer to v than A_{i+1} is, with their distances.
+  // A query alternates between the pivots of its two vertices until one is in
+  // the bunch of the other, so it takes O(k) hash lookups and returns a
+  // distance within 2k - 1 times the distance in g. The expected size of the
+  // bunches is O(k n^(1/k)) each.
+  class DistanceOracle {
+    public:
+      DistanceOracle(const Graph& g, const ClusterHierarchy& hierarchy);
+
+      // An estimate of d_g(u, v), d_g(u, v) <= query(u, v) <=
+      // (2 * levels() - 1) * d_g(u, v), infinity if they are disconnected.
+      double query(int u, int v) const;
+
+      int levels() const { return pivot.size(); }
+      // Number of (vertex, bunch member) entries, the oracle's space is
+      // O(bunch_entries() + k n).
+      long bunch_entries() const;
+
+    private:
+      // pivot[i][v] is p_i(v), or -1 if no vertex of A_i is connected to v,
+      // and pivot_distance[i][v] its distance from v.
+      std::vector<std::vector<int>> pivot;
+      std::vector<std::vector<double>> pivot_distance;
+      std::vector<std::unordered_map<int, double>> bunch;
+  };
+}  // namespace graphs
+#endif
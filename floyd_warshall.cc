@@ -0,0 +1,259 @@
+#include "floyd_warshall.h"
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "util.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FLOYD_WARSHALL_X86
+#include <immintrin.h>
+#endif
+
+namespace graphs {
+namespace {
+  constexpr int B = DistanceMatrix<double>::kBlock;
+
+  template<typename T>
+  using MinPlusKernel = void (*)(T* c, const T* a, const T* b);
+
+  // c = min(c, a (min,+) b) where c, a and b are B x B tiles that do not
+  // overlap.
+  template<typename T>
+  void minplus_generic(T* c, const T* a, const T* b) {
+    for (int i = 0; i < B; ++i) {
+      T* c_row = c + i * B;
+      for (int k = 0; k < B; ++k) {
+        const T a_ik = a[i * B + k];
+        const T* b_row = b + k * B;
+        for (int j = 0; j < B; ++j)
+          c_row[j] = std::min(c_row[j], a_ik + b_row[j]);
+      }
+    }
+  }
+
+#ifdef FLOYD_WARSHALL_X86
+  // The SIMD kernels keep half a row of c in registers while going over k.
+  __attribute__((target("avx2")))
+  void minplus_avx2(double* c, const double* a, const double* b) {
+    for (int i = 0; i < B; ++i) {
+      for (int half = 0; half < B; half += B / 2) {
+        double* c_row = c + i * B + half;
+        __m256d acc[8];
+        for (int r = 0; r < 8; ++r)
+          acc[r] = _mm256_load_pd(c_row + 4 * r);
+        for (int k = 0; k < B; ++k) {
+          const __m256d a_ik = _mm256_set1_pd(a[i * B + k]);
+          const double* b_row = b + k * B + half;
+          for (int r = 0; r < 8; ++r) {
+            acc[r] = _mm256_min_pd(acc[r],
+                _mm256_add_pd(a_ik, _mm256_load_pd(b_row + 4 * r)));
+          }
+        }
+        for (int r = 0; r < 8; ++r)
+          _mm256_store_pd(c_row + 4 * r, acc[r]);
+      }
+    }
+  }
+
+  __attribute__((target("avx2")))
+  void minplus_avx2(float* c, const float* a, const float* b) {
+    for (int i = 0; i < B; ++i) {
+      float* c_row = c + i * B;
+      __m256 acc[8];
+      for (int r = 0; r < 8; ++r)
+        acc[r] = _mm256_load_ps(c_row + 8 * r);
+      for (int k = 0; k < B; ++k) {
+        const __m256 a_ik = _mm256_set1_ps(a[i * B + k]);
+        const float* b_row = b + k * B;
+        for (int r = 0; r < 8; ++r) {
+          acc[r] = _mm256_min_ps(acc[r],
+              _mm256_add_ps(a_ik, _mm256_load_ps(b_row + 8 * r)));
+        }
+      }
+      for (int r = 0; r < 8; ++r)
+        _mm256_store_ps(c_row + 8 * r, acc[r]);
+    }
+  }
+
+  __attribute__((target("avx512f")))
+  void minplus_avx512(double* c, const double* a, const double* b) {
+    for (int i = 0; i < B; ++i) {
+      double* c_row = c + i * B;
+      __m512d acc[8];
+      for (int r = 0; r < 8; ++r)
+        acc[r] = _mm512_load_pd(c_row + 8 * r);
+      for (int k = 0; k < B; ++k) {
+        const __m512d a_ik = _mm512_set1_pd(a[i * B + k]);
+        const double* b_row = b + k * B;
+        for (int r = 0; r < 8; ++r) {
+          acc[r] = _mm512_min_pd(acc[r],
+              _mm512_add_pd(a_ik, _mm512_load_pd(b_row + 8 * r)));
+        }
+      }
+      for (int r = 0; r < 8; ++r)
+        _mm512_store_pd(c_row + 8 * r, acc[r]);
+    }
+  }
+
+  __attribute__((target("avx512f")))
+  void minplus_avx512(float* c, const float* a, const float* b) {
+    for (int i = 0; i < B; ++i) {
+      float* c_row = c + i * B;
+      __m512 acc[4];
+      for (int r = 0; r < 4; ++r)
+        acc[r] = _mm512_load_ps(c_row + 16 * r);
+      for (int k = 0; k < B; ++k) {
+        const __m512 a_ik = _mm512_set1_ps(a[i * B + k]);
+        const float* b_row = b + k * B;
+        for (int r = 0; r < 4; ++r) {
+          acc[r] = _mm512_min_ps(acc[r],
+              _mm512_add_ps(a_ik, _mm512_load_ps(b_row + 16 * r)));
+        }
+      }
+      for (int r = 0; r < 4; ++r)
+        _mm512_store_ps(c_row + 16 * r, acc[r]);
+    }
+  }
+#endif
+
+  // Picks the widest kernel the cpu supports.
+  template<typename T>
+  MinPlusKernel<T> best_kernel() {
+#ifdef FLOYD_WARSHALL_X86
+    if (__builtin_cpu_supports("avx512f"))
+      return static_cast<MinPlusKernel<T>>(minplus_avx512);
+    if (__builtin_cpu_supports("avx2"))
+      return static_cast<MinPlusKernel<T>>(minplus_avx2);
+#endif
+    return minplus_generic<T>;
+  }
+
+  // Floyd-Warshall restricted to the tiles c, a and b: for every k in the tile,
+  // c = min(c, a[., k] + b[k, .]). Unlike minplus, a or b may be c itself,
+  // which is what settles the diagonal tile and the tiles of its row and
+  // column. These are only O(n / B) of the O((n / B)^2) tiles of a round, so
+  // they are left to the compiler.
+  template<typename T>
+  void floydwarshall_tile(T* c, const T* a, const T* b) {
+    for (int k = 0; k < B; ++k) {
+      for (int i = 0; i < B; ++i) {
+        const T a_ik = a[i * B + k];
+        T* c_row = c + i * B;
+        const T* b_row = b + k * B;
+        for (int j = 0; j < B; ++j)
+          c_row[j] = std::min(c_row[j], a_ik + b_row[j]);
+      }
+    }
+  }
+
+  template<typename T>
+  void transpose_tile(const T* from, T* to) {
+    for (int i = 0; i < B; ++i)
+      for (int j = 0; j < B; ++j)
+        to[j * B + i] = from[i * B + j];
+  }
+
+  template<typename T>
+  DistanceMatrix<T> initial_distances(const Graph& g, bool packed) {
+    DistanceMatrix<T> dists(g.size(), packed);
+    const int padded = dists.blocks() * B;
+    dists.fill(std::numeric_limits<T>::infinity());
+    // Padding vertices are isolated, so they don't change any distance.
+    for (int i = 0; i < padded; ++i) {
+      dists.block(i / B, i / B)[(i % B) * B + i % B] = 0;
+    }
+    for (int i = 0; i < g.size(); ++i) {
+      for (const auto& e : g.neighbors(i)) {
+        auto& d = dists.at(i, e.end);
+        d = std::min(d, static_cast<T>(e.w));
+      }
+    }
+    return dists;
+  }
+
+  // Every round settles the diagonal tile kb, then the tiles of its row and
+  // column, and then minplus updates all the other tiles in parallel.
+  template<typename T>
+  void full_rounds(DistanceMatrix<T>& dists, MinPlusKernel<T> minplus) {
+    const int nb = dists.blocks();
+    for (int kb = 0; kb < nb; ++kb) {
+      T* diagonal = dists.block(kb, kb);
+      floydwarshall_tile(diagonal, diagonal, diagonal);
+      // Tasks [0, nb) update the row of the diagonal, [nb, 2nb) its column.
+      util::parallel_for(0, 2 * nb, [&] (int, int task) {
+        const int other = task % nb;
+        if (other == kb)
+          return;
+        if (task < nb) {
+          T* c = dists.block(kb, other);
+          floydwarshall_tile(c, diagonal, c);
+        } else {
+          T* c = dists.block(other, kb);
+          floydwarshall_tile(c, c, diagonal);
+        }
+      });
+      util::parallel_for(0, nb * nb, [&] (int, int task) {
+        const int bi = task / nb, bj = task % nb;
+        if (bi == kb || bj == kb)
+          return;
+        minplus(dists.block(bi, bj), dists.block(bi, kb), dists.block(kb, bj));
+      });
+    }
+  }
+
+  // Same rounds on the lower triangle of tiles. The tile (i, j) above the
+  // diagonal is the transpose of the stored tile (j, i), so the tiles of the
+  // round's row and column that are not stored are transposed into scratch
+  // space before the update.
+  template<typename T>
+  void packed_rounds(DistanceMatrix<T>& dists, MinPlusKernel<T> minplus) {
+    const int nb = dists.blocks();
+    auto scratch = aligned_array<T>(size_t(nb) * B * B);
+    std::vector<const T*> column(nb), row(nb);
+    std::vector<std::pair<int, int>> lower_tiles;
+    for (int bi = 0; bi < nb; ++bi)
+      for (int bj = 0; bj <= bi; ++bj)
+        lower_tiles.emplace_back(bi, bj);
+    for (int kb = 0; kb < nb; ++kb) {
+      T* diagonal = dists.block(kb, kb);
+      floydwarshall_tile(diagonal, diagonal, diagonal);
+      // Row and column of the diagonal hold the same tiles, transposed.
+      util::parallel_for(0, nb, [&] (int, int other) {
+        if (other > kb) {
+          T* c = dists.block(other, kb);
+          floydwarshall_tile(c, c, diagonal);
+          column[other] = c;
+          transpose_tile(c, scratch.get() + size_t(other) * B * B);
+          row[other] = scratch.get() + size_t(other) * B * B;
+        } else if (other < kb) {
+          T* c = dists.block(kb, other);
+          floydwarshall_tile(c, diagonal, c);
+          row[other] = c;
+          transpose_tile(c, scratch.get() + size_t(other) * B * B);
+          column[other] = scratch.get() + size_t(other) * B * B;
+        }
+      });
+      util::parallel_for(0, lower_tiles.size(), [&] (int, int task) {
+        const int bi = lower_tiles[task].first, bj = lower_tiles[task].second;
+        if (bi == kb || bj == kb)
+          return;
+        minplus(dists.block(bi, bj), column[bi], row[bj]);
+      });
+    }
+  }
+}  // namespace
+
+template<typename T>
+DistanceMatrix<T> blocked_floydwarshall(const Graph& g, bool packed) {
+  static const auto minplus = best_kernel<T>();
+  auto dists = initial_distances<T>(g, packed);
+  if (packed) {
+    packed_rounds(dists, minplus);
+  } else {
+    full_rounds(dists, minplus);
+  }
+  return dists;
+}
+
+template DistanceMatrix<float> blocked_floydwarshall(const Graph&, bool);
+template DistanceMatrix<double> blocked_floydwarshall(const Graph&, bool);
+}  // namespace graphs
@@ -0,0 +1,87 @@
+#ifndef FLOYD_WARSHALL_H
+#define FLOYD_WARSHALL_H
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <new>
+#include "graph.h"
+
+namespace graphs {
+  // An array aligned to a cache line.
+  template<typename T>
+  using AlignedArray = std::unique_ptr<T[], void (*)(void*)>;
+
+  template<typename T>
+  AlignedArray<T> aligned_array(size_t count) {
+    void* p = nullptr;
+    if (posix_memalign(&p, 64, std::max<size_t>(count, 1) * sizeof(T)))
+      throw std::bad_alloc();
+    return AlignedArray<T>(static_cast<T*>(p), std::free);
+  }
+
+  // An n x n matrix of distances held in one contiguous, cache line aligned
+  // buffer of kBlock x kBlock tiles (the last row and column of tiles are
+  // padded). A packed matrix is symmetric and stores only the tiles on and
+  // below the diagonal, about half the memory.
+  template<typename T>
+  class DistanceMatrix {
+    public:
+      static constexpr int kBlock = 64;
+
+      DistanceMatrix(int n, bool packed):
+        n(n), nb((n + kBlock - 1) / kBlock), is_packed(packed),
+        data(aligned_array<T>(num_blocks() * kBlock * kBlock)) {}
+
+      int size() const { return n; }
+      bool packed() const { return is_packed; }
+      // Number of tiles in a row (or column) of the matrix.
+      int blocks() const { return nb; }
+
+      // In a packed matrix (i, j) and (j, i) are the same entry, unless both
+      // are in the same diagonal tile which is stored in full.
+      T operator()(int i, int j) const { return data[offset(i, j)]; }
+      T& at(int i, int j) { return data[offset(i, j)]; }
+
+      void fill(T value) {
+        std::fill_n(data.get(), num_blocks() * kBlock * kBlock, value);
+      }
+
+      // The tile of rows [bi * kBlock, (bi + 1) * kBlock) and columns
+      // [bj * kBlock, (bj + 1) * kBlock), row major. A packed matrix only has
+      // the tiles with bi >= bj.
+      T* block(int bi, int bj) {
+        return data.get() + block_index(bi, bj) * kBlock * kBlock;
+      }
+
+    private:
+      size_t num_blocks() const {
+        return is_packed ? size_t(nb) * (nb + 1) / 2 : size_t(nb) * nb;
+      }
+      size_t block_index(int bi, int bj) const {
+        return is_packed ? size_t(bi) * (bi + 1) / 2 + bj :
+          size_t(bi) * nb + bj;
+      }
+      size_t offset(int i, int j) const {
+        if (is_packed && i / kBlock < j / kBlock)
+          std::swap(i, j);
+        return block_index(i / kBlock, j / kBlock) * kBlock * kBlock +
+          (i % kBlock) * kBlock + j % kBlock;
+      }
+
+      int n;
+      int nb;
+      bool is_packed;
+      AlignedArray<T> data;
+  };
+
+  // All pairs shortest paths of g by a tiled min-plus Floyd-Warshall. Every
+  // round settles the diagonal tile, then the tiles of its row and column, and
+  // then updates all the other tiles in parallel with an AVX-512 or AVX2
+  // kernel (whichever the cpu supports). 'packed' selects the half-size
+  // symmetric storage, only valid since our graphs are undirected. Use float
+  // to halve the memory and double the SIMD width, at the cost of precision.
+  template<typename T>
+  DistanceMatrix<T> blocked_floydwarshall(const Graph& g, bool packed = false);
+}  // namespace graphs
+#endif
@@ -1,4 +1,5 @@
 #include "graph.h"
+#include "floyd_warshall.h"
 #include <iostream>
 #include <ctime>
 #include <cstdlib>
@@ -6,6 +7,9 @@
 #include <fstream>
 #include <string>
 #include <limits>
+#include <atomic>
+#include <utility>
+#include <algorithm>
 
 using namespace std;
 namespace graphs {
@@ -45,6 +49,21 @@ namespace graphs {
     return result;
   }
 
+  Graph randomGraph(int num_v, double edge_density,
+      const EdgeWeightSampler& edge_weight, unsigned long seed) {
+    util::RandomEngine generator(seed);
+    std::uniform_real_distribution<double> coin(0, 1);
+    Graph result(num_v);
+    for (int i = 0; i < num_v; ++i) {
+      for (int j = i + 1; j < num_v; ++j) {
+        if (coin(generator) < edge_density) {
+          result.add_edge(i, j, edge_weight(generator));
+        }
+      }
+    }
+    return result;
+  }
+
   std::ostream& operator<<(std::ostream& os, const Edge& g) {
     os << "(" << g.end << "," << g.w << ")";
     return os;
@@ -68,15 +87,20 @@ namespace graphs {
 
     distances[src] = 0;
     for (int i = 0; i < g.size(); ++i) {
+      bool changed = false;
       // to go over the edges we go over the vertices.
       for(int v = 0; v < g.size(); ++v) {
         for (const auto& edge : g.neighbors(v)) {
           if (distances[v] + edge.w < distances[edge.end]) {
             distances[edge.end] = distances[v] + edge.w;
             predecessors[edge.end] = v;
+            changed = true;
           }
         }
       }
+      // A round that relaxes nothing means the distances converged.
+      if (!changed)
+        break;
     }
     // TODO(check negative cycles)
     for(int v = 0; v < g.size(); ++v) {
@@ -91,50 +115,102 @@ namespace graphs {
 
   vector<vector<double>> floydwarshall(const Graph& g) {
     //scoped_timer st("floydwarshall");
-    vector<vector<double>> dists (g.size(),
-        vector<double>(g.size(), std::numeric_limits<double>::infinity()));
-    // Initialize the dists with the edge weight for the graph.
-    for (int i = 0; i < g.size(); ++i) {
-      dists[i][i] = 0;
-    }
-    for (int i = 0; i < g.size(); ++i) {
-      for(int j = 0; j < g.size(); ++j) {
-        if (g.has_edge(i, j)) {
-          // put its weight in i , j;
-          for (const auto& e : g.neighbors(i)) {
-            if (e.end == j) {
-              dists[i][j] = e.w;
-              break;
-            }
-          }
+    auto blocked = blocked_floydwarshall<double>(g);
+    vector<vector<double>> dists(g.size(), vector<double>(g.size()));
+    for (int i = 0; i < g.size(); ++i)
+      for (int j = 0; j < g.size(); ++j)
+        dists[i][j] = blocked(i, j);
+    return dists;
+  }
+
+  namespace {
+    // The root of v's tree, halving the path on the way.
+    int find_root(std::vector<std::atomic<int>>& parent, int v) {
+      while (true) {
+        int p = parent[v].load(std::memory_order_relaxed);
+        if (p == v)
+          return v;
+        int grandparent = parent[p].load(std::memory_order_relaxed);
+        if (p != grandparent) {
+          // Parents only ever decrease, so losing this race is harmless.
+          parent[v].compare_exchange_weak(p, grandparent,
+              std::memory_order_relaxed);
         }
+        v = grandparent;
       }
     }
 
-    for (int k = 0; k < g.size(); ++k)
-      for (int i = 0; i < g.size(); ++i)
-        for (int j = 0; j < g.size(); ++j)
-          dists[i][j] = std::min(dists[i][j], dists[i][k] + dists[k][j]);
-    return dists;
+    void unite(std::vector<std::atomic<int>>& parent, int u, int v) {
+      while (true) {
+        int root_u = find_root(parent, u), root_v = find_root(parent, v);
+        if (root_u == root_v)
+          return;
+        if (root_u < root_v)
+          std::swap(root_u, root_v);
+        // Fails if root_u got linked meanwhile, then retry from its new root.
+        if (parent[root_u].compare_exchange_strong(root_u, root_v))
+          return;
+      }
+    }
+  }  // namespace
+
+  vector<int> connected_components(const Graph& g) {
+    const int n = g.size();
+    std::vector<std::atomic<int>> parent(n);
+    for (int v = 0; v < n; ++v)
+      parent[v].store(v, std::memory_order_relaxed);
+    util::parallel_for(0, n, [&] (int, int u) {
+      for (const auto& e : g.neighbors(u)) {
+        if (u < e.end)
+          unite(parent, u, e.end);
+      }
+    }, 256);
+    // A root is the smallest vertex of its tree, as links only point down.
+    vector<int> labels(n);
+    util::parallel_for(0, n, [&] (int, int v) {
+      labels[v] = find_root(parent, v);
+    }, 1024);
+    return labels;
   }
 
-  // TODO: Using floydwarshall to check this is VERY slow, should do a dfs or 
-  // bfs.
   bool check_subgraph_disconnection(const Graph& g, const Graph& subgraph) {
-    auto dsts_g = floydwarshall(g);
-    auto dsts_s = floydwarshall(subgraph); 
-    for (int i = 0; i < g.size(); ++i) {
-      for(int j = i + 1; j < g.size(); ++j) {
-        if (dsts_g[i][j] != std::numeric_limits<double>::infinity() &&
-            dsts_s[i][j] == std::numeric_limits<double>::infinity()) {
-          cout << "found bad pair " << i << ", " << j << endl;
-          return true;
-        }
+    auto components_g = connected_components(g);
+    auto components_s = connected_components(subgraph);
+    // The components of subgraph split those of g, so it disconnects a pair
+    // iff it splits some vertex from the smallest vertex of its component.
+    for (int v = 0; v < g.size(); ++v) {
+      const int first = components_g[v];
+      if (components_s[v] != components_s[first]) {
+        cout << "found bad pair " << first << ", " << v << endl;
+        return true;
       }
     }
     return false;
   }
 
+  void sort_and_dedup_edges(std::vector<ExtendedEdge>& edges) {
+    util::parallel_for(0, edges.size(), [&] (int, int i) {
+      auto& e = edges[i];
+      if (e.v < e.u)
+        std::swap(e.u, e.v);
+    }, 4096);
+    util::parallel_sort(std::begin(edges), std::end(edges),
+        [] (const ExtendedEdge& a, const ExtendedEdge& b) {
+          return a.u != b.u ? a.u < b.u : a.v != b.v ? a.v < b.v : a.w < b.w;
+        });
+    edges.erase(std::unique(std::begin(edges), std::end(edges),
+          [] (const ExtendedEdge& a, const ExtendedEdge& b) {
+            return a.u == b.u && a.v == b.v;
+          }), std::end(edges));
+  }
+
+  Graph graph_from_edges(int n, const std::vector<ExtendedEdge>& edges) {
+    Graph g(n);
+    for (const auto& e : edges)
+      g.add_edge(e.u, e.v, e.w);
+    return g;
+  }
+
   void Graph::clear_neighbors(int v) {
     for (const auto& edge : adj_list[v]) {
       adj_list[edge.end].erase({v, edge.w}); 
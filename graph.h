@@ -95,6 +95,21 @@ namespace graphs {
         }
       }
 
+      // Removes the edges e of vertex s.t pred(e) from vertex' list only, so
+      // calls for different vertices can run in parallel. Calling it on both
+      // ends of every edge with a symmetric pred keeps the graph undirected.
+      template<typename Pred>
+      void filter_neighbors(int vertex, Pred&& pred) {
+        auto& neighbors = adj_list[vertex];
+        for (auto it = std::begin(neighbors); it != std::end(neighbors);) {
+          if (pred(*it)) {
+            it = neighbors.erase(it);
+          } else {
+            ++it;
+          }
+        }
+      }
+
       // Returns a graph which is g without all the edges in g s.t pred(e)=true.
       // TODO(): if the predicate is not symmetric this may turn an undirected
       // graph to a directed one..
@@ -116,11 +131,27 @@ namespace graphs {
       void clear_neighbors(int v);
   };
 
+  // Returns the connected component of every vertex of g, labeled by its
+  // smallest vertex. Computed in parallel over the vertices by a lock-free
+  // union-find: links are CAS operations that always point a root at a
+  // smaller root, and finds halve the paths they walk.
+  std::vector<int> connected_components(const Graph& g);
+
+  // Returns true (and prints one such pair) if some pair of vertices connected
+  // in g is disconnected in subgraph, which must be a subgraph of g.
   bool check_subgraph_disconnection(const Graph& g, const Graph& subgraph);
 
+  // Draws a single edge weight from 'generator'.
+  using EdgeWeightSampler = std::function<double(util::RandomEngine&)>;
+
   // Generates a random graph with n vertices.
   Graph randomGraph(int n, double edge_density = 0.5,
       const std::function<double(void)>& edge_weight = util::random_real);
+  // Generates a random graph with n vertices where both the coin flips and the
+  // edge weights are drawn from an engine seeded with 'seed', i.e the same
+  // arguments always produce the same graph.
+  Graph randomGraph(int n, double edge_density,
+      const EdgeWeightSampler& edge_weight, unsigned long seed);
   std::vector<double> bellmanford(const Graph& g, int src);
   std::vector<std::vector<double>> floydwarshall(const Graph& g);
   std::ostream& operator<<(std::ostream& os, const Edge& g);
@@ -140,5 +171,18 @@ namespace graphs {
   inline bool operator<(const ExtendedEdge& a, const ExtendedEdge& b) {
     return a.w < b.w;
   }
+
+  // A spanner as a flat list of edges, for the algorithms' edge list output
+  // mode: add_edge appends, so it can stand in for a Graph being built.
+  struct EdgeList {
+    std::vector<ExtendedEdge> edges;
+    void add_edge(int u, int v, double w) { edges.emplace_back(u, v, w); }
+  };
+
+  // Turns every edge (u, v) into u <= v, sorts the edges by (u, v) in
+  // parallel and keeps the lightest copy of each.
+  void sort_and_dedup_edges(std::vector<ExtendedEdge>& edges);
+  // The graph with n vertices and the given edges.
+  Graph graph_from_edges(int n, const std::vector<ExtendedEdge>& edges);
 } // namespace graphs.
 #endif
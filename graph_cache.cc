@@ -0,0 +1,229 @@
+#include "graph_cache.h"
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+namespace graphs {
+namespace {
+  constexpr char kMagic[4] = {'T', 'S', 'P', 'G'};
+
+  template<typename T>
+  void write_value(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template<typename T>
+  bool read_value(std::istream& in, T* value) {
+    return static_cast<bool>(
+        in.read(reinterpret_cast<char*>(value), sizeof(T)));
+  }
+
+  // The shortest decimal form of 'value' that reads back as 'value', so keys
+  // of different densities never collide and the common ones stay short.
+  std::string exact_string(double value) {
+    std::string result;
+    for (int precision = 6;
+        precision <= std::numeric_limits<double>::max_digits10; ++precision) {
+      std::ostringstream os;
+      os.precision(precision);
+      os << value;
+      result = os.str();
+      if (std::stod(result) == value)
+        break;
+    }
+    return result;
+  }
+
+  // Creates 'path' and its missing parents, like mkdir -p. Returns false
+  // with errno set if some component could not be created or is not a
+  // directory.
+  bool make_directories(const std::string& path) {
+    for (auto end = path.find('/', 1); ; end = path.find('/', end + 1)) {
+      const auto prefix = path.substr(0, end);
+      if (mkdir(prefix.c_str(), 0777) != 0 && errno != EEXIST)
+        return false;
+      if (end == std::string::npos)
+        break;
+    }
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+      return false;
+    if (!S_ISDIR(info.st_mode)) {
+      errno = ENOTDIR;
+      return false;
+    }
+    return true;
+  }
+
+  // Approximate memory taken by g: a hash set per vertex and a node plus a
+  // bucket per edge end.
+  size_t approximate_bytes(const Graph& g) {
+    constexpr size_t kBytesPerEdgeEnd = sizeof(Edge) + 3 * sizeof(void*);
+    return g.size() * sizeof(std::unordered_set<Edge>) +
+      g.edges() * kBytesPerEdgeEnd;
+  }
+}  // namespace
+
+std::string RandomGraphKey::to_string() const {
+  std::ostringstream os;
+  os << "n" << size << "_d" << exact_string(density) << "_" << edge_weight
+    << "_s" << seed;
+  auto name = os.str();
+  // The key doubles as a file name.
+  for (auto& c : name) {
+    if (c == '/' || c == ':' || c == ' ')
+      c = '-';
+  }
+  return name;
+}
+
+bool write_graph(const Graph& g, std::ostream& out) {
+  out.write(kMagic, sizeof(kMagic));
+  write_value<int32_t>(out, g.size());
+  write_value<int64_t>(out, g.edges() / 2);
+  for (int u = 0; u < g.size(); ++u) {
+    for (const auto& e : g.neighbors(u)) {
+      if (u < e.end) {
+        write_value<int32_t>(out, u);
+        write_value<int32_t>(out, e.end);
+        write_value<double>(out, e.w);
+      }
+    }
+  }
+  return static_cast<bool>(out);
+}
+
+bool read_graph(std::istream& in, Graph* g) {
+  char magic[sizeof(kMagic)];
+  int32_t n;
+  int64_t m;
+  if (!in.read(magic, sizeof(magic)) ||
+      !std::equal(std::begin(magic), std::end(magic), std::begin(kMagic)) ||
+      !read_value(in, &n) || !read_value(in, &m) || n < 0) {
+    return false;
+  }
+  Graph result(n);
+  for (int64_t i = 0; i < m; ++i) {
+    int32_t u, v;
+    double w;
+    if (!read_value(in, &u) || !read_value(in, &v) || !read_value(in, &w) ||
+        u < 0 || v < 0 || u >= n || v >= n) {
+      return false;
+    }
+    result.add_edge(u, v, w);
+  }
+  *g = std::move(result);
+  return true;
+}
+
+GraphCache& GraphCache::instance() {
+  static GraphCache cache;
+  return cache;
+}
+
+bool GraphCache::set_directory(const std::string& dir) {
+  std::lock_guard<std::mutex> lock(mutex);
+  directory.clear();
+  if (!dir.empty() && !make_directories(dir))
+    return false;
+  directory = dir;
+  return true;
+}
+
+void GraphCache::set_capacity(size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  capacity = bytes;
+  evict(capacity);
+}
+
+void GraphCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  evict(0);
+}
+
+void GraphCache::evict(size_t limit) {
+  for (auto key = lru.end(); key != lru.begin() && total_bytes > limit;) {
+    --key;
+    auto entry = graphs.find(*key);
+    if (entry->second.bytes == 0)
+      continue;
+    total_bytes -= entry->second.bytes;
+    graphs.erase(entry);
+    key = lru.erase(key);
+  }
+}
+
+std::shared_ptr<const Graph> GraphCache::get(const RandomGraphKey& key,
+    const EdgeWeightSampler& edge_weight) {
+  const auto name = key.to_string();
+  std::promise<std::shared_ptr<const Graph>> promise;
+  std::shared_future<std::shared_ptr<const Graph>> pending;
+  bool generate = false;
+  std::string dir;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = graphs.find(name);
+    if (entry != std::end(graphs)) {
+      pending = entry->second.graph;
+      lru.splice(std::begin(lru), lru, entry->second.use);
+    } else {
+      pending = promise.get_future().share();
+      lru.push_front(name);
+      graphs.emplace(name, Entry{pending, 0, std::begin(lru)});
+      generate = true;
+      dir = directory;
+    }
+  }
+  // The graph may still be generated by another thread, so we wait for it
+  // outside the lock.
+  if (!generate)
+    return pending.get();
+  auto result = load_or_generate(key, edge_weight, dir);
+  promise.set_value(result);
+  {
+    // Entries being generated are never evicted, so ours is still there.
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& entry = graphs.at(name);
+    entry.bytes = std::max<size_t>(1, approximate_bytes(*result));
+    total_bytes += entry.bytes;
+    evict(capacity);
+  }
+  return result;
+}
+
+std::shared_ptr<const Graph> GraphCache::load_or_generate(
+    const RandomGraphKey& key, const EdgeWeightSampler& edge_weight,
+    const std::string& dir) {
+  const auto path = dir.empty() ? "" : dir + "/" + key.to_string() + ".graph";
+  if (!path.empty()) {
+    std::ifstream in(path, std::ios::binary);
+    Graph g;
+    if (in && read_graph(in, &g)) {
+      return std::make_shared<const Graph>(std::move(g));
+    }
+  }
+  auto g = std::make_shared<const Graph>(
+      randomGraph(key.size, key.density, edge_weight, key.seed));
+  if (!path.empty()) {
+    // Write to a temporary file first so concurrent runs never read a
+    // partially written graph.
+    const auto tmp_path = path + ".tmp" + std::to_string(
+        std::hash<std::thread::id>()(std::this_thread::get_id()));
+    std::ofstream out(tmp_path, std::ios::binary);
+    if (write_graph(*g, out)) {
+      out.close();
+      std::rename(tmp_path.c_str(), path.c_str());
+    } else {
+      std::remove(tmp_path.c_str());
+    }
+  }
+  return g;
+}
+}  // namespace graphs
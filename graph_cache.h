@@ -0,0 +1,86 @@
+#ifndef GRAPH_CACHE_H
+#define GRAPH_CACHE_H
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "graph.h"
+
+namespace graphs {
+  // The parameters that fully determine a seeded random graph, see the seeded
+  // overload of randomGraph.
+  struct RandomGraphKey {
+    int size;
+    double density;
+    // Name of the edge weight distribution including its parameters, e.g
+    // "exponential:0.05". Two samplers with the same name must draw the same
+    // weights from the same engine.
+    std::string edge_weight;
+    unsigned long seed;
+
+    std::string to_string() const;
+  };
+
+  // A process wide cache of immutable random graphs. Experiments (and the
+  // different algorithms they run) that ask for the same key share a single
+  // generated graph instead of generating it again. If a directory is set the
+  // graphs are also stored there, so later runs of the program can load them
+  // instead of generating them. The graphs held in memory are capped by
+  // their approximate size, the least recently used ones are dropped first
+  // (callers still holding one keep it alive).
+  class GraphCache {
+    public:
+      static GraphCache& instance();
+
+      // Sets the directory for the on-disk cache, creating it and its parents
+      // if needed. An empty string disables it. Returns false (and leaves the
+      // on-disk cache disabled) if the directory could not be created.
+      bool set_directory(const std::string& dir);
+
+      // Sets the approximate number of bytes of graphs held in memory.
+      void set_capacity(size_t bytes);
+
+      // Returns the graph for 'key', generating it with 'edge_weight' if it is
+      // neither in memory nor on disk. Concurrent calls with the same key wait
+      // for a single generation.
+      std::shared_ptr<const Graph> get(const RandomGraphKey& key,
+          const EdgeWeightSampler& edge_weight);
+
+      // Drops all the graphs held in memory, except those still being
+      // generated.
+      void clear();
+
+    private:
+      GraphCache() {}
+      std::shared_ptr<const Graph> load_or_generate(const RandomGraphKey& key,
+          const EdgeWeightSampler& edge_weight, const std::string& dir);
+      // Drops the least recently used graphs until the rest take at most
+      // 'limit' bytes. Graphs that are still being generated are kept.
+      // Requires the mutex.
+      void evict(size_t limit);
+
+      struct Entry {
+        std::shared_future<std::shared_ptr<const Graph>> graph;
+        // Approximate size of the graph, 0 while it is being generated.
+        size_t bytes = 0;
+        // Position of the key in lru.
+        std::list<std::string>::iterator use;
+      };
+
+      std::mutex mutex;
+      std::string directory;
+      size_t capacity = size_t(4) << 30;
+      size_t total_bytes = 0;
+      std::unordered_map<std::string, Entry> graphs;
+      // Keys of the graphs, most recently used first.
+      std::list<std::string> lru;
+  };
+
+  // Writes 'g' as a binary edge list, returns false on failure.
+  bool write_graph(const Graph& g, std::ostream& out);
+  // Reads a graph written by write_graph, returns false on failure.
+  bool read_graph(std::istream& in, Graph* g);
+}  // namespace graphs
+#endif
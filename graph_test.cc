@@ -1,13 +1,24 @@
 #include <iostream>
 #include <string>
+#include <sstream>
 #include <vector>
 #include <fstream>
 #include <cassert>
 #include <chrono>
 #include <thread>
 #include <future>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
 #include "three-spanner-algorithm.h"
 #include "2k_spanner.h"
+#include "graph_cache.h"
+#include "coupled_graphs.h"
+#include "alias_sampler.h"
+#include "stretch.h"
+#include "contraction_hierarchy.h"
+#include "distance_oracle.h"
+#include "shortest_paths.h"
 #include "json.hpp"
 
 using namespace std;
@@ -58,16 +69,99 @@ struct ExperimentArgs {
   double graph_density;
   int k;  // Needed only for the 2k-1 spanner algorithm.
   int num_runs;  // How many random graphs to try it on.
-  std::function<double(void)> edge_weight = util::random_real;
+  EdgeWeightSampler edge_weight = [] (util::RandomEngine& generator) {
+    return std::uniform_real_distribution<double>(0, 1)(generator);
+  };
+  // Identifies edge_weight in the graph cache.
+  string edge_weight_name = "uniform";
+  // Run i uses the graph generated with seed + i, a negative seed means every
+  // run gets a fresh graph.
+  long long seed = -1;
+  // If set, the graphs are drawn together with the other points of the sweep.
+  std::shared_ptr<CoupledGraphs> coupled;
+  // If set, MaxStretch compares all pairs distances instead of the edges.
+  bool all_pairs_stretch = false;
+  // If set (and all_pairs_stretch), run i writes the stretch of every edge of
+  // its graph to <edge_stretch_dump>_<size>_<i>.txt.
+  string edge_stretch_dump;
+  // Used only by StretchSample.
+  StretchSampleOptions sample_options;
+  // Used only by OracleQueries, number of queries per run.
+  int num_queries = 100000;
+  // The stretch the algorithm guarantees, checked on every spanner when
+  // --validate_spanners is set.
+  double stretch_bound = 0;
   ExperimentArgs(int size, const json& experiment_info):
     graph_size(size), graph_density(experiment_info["density"]),
         k(experiment_info.count("k") != 0 ? int(experiment_info["k"]) : -1),
         num_runs(experiment_info["num_runs_per_size"]) {}
   ExperimentArgs(int sz, double d, int k, int num_runs):
     graph_size(sz), graph_density(d), k(k), num_runs(num_runs) {}
+
+  // Returns the random graph for the run'th run. Seeded graphs are shared
+  // through the GraphCache with every other experiment asking for them.
+  std::shared_ptr<const Graph> graph(int run) const {
+    if (coupled) {
+      return std::make_shared<const Graph>(
+          coupled->graph(run, graph_size, graph_density));
+    }
+    if (seed < 0) {
+      static std::atomic<unsigned long> fresh_seed(std::random_device{}());
+      return std::make_shared<const Graph>(
+          randomGraph(graph_size, graph_density, edge_weight, fresh_seed++));
+    }
+    return GraphCache::instance().get(
+        {graph_size, graph_density, edge_weight_name,
+         static_cast<unsigned long>(seed + run)},
+        edge_weight);
+  }
 };
 
 
+// A spanner returned by an algorithm as a Graph, or in edge list form.
+const Graph& SpannerGraph(const Graph&, const Graph& spanner) {
+  return spanner;
+}
+Graph SpannerGraph(const Graph& g, const vector<ExtendedEdge>& spanner) {
+  return graph_from_edges(g.size(), spanner);
+}
+
+// Number of edges, counted like Graph::edges once per endpoint.
+long SpannerEdges(const Graph& spanner) { return spanner.edges(); }
+long SpannerEdges(const vector<ExtendedEdge>& spanner) {
+  return 2 * spanner.size();
+}
+
+// Returns alg(g), a Graph or an edge list. With --validate_spanners it first
+// checks that the spanner keeps every pair of vertices of g connected (a
+// near-linear union-find pass) and that it stretches no edge of g beyond
+// args.stretch_bound, and exits at the first failed check.
+template<typename SpannerAlg>
+auto BuildSpanner(SpannerAlg&& alg, const Graph& g,
+    const ExperimentArgs& args) {
+  auto spanner = alg(g);
+  if (!util::get_bool_flag("validate_spanners"))
+    return spanner;
+  const Graph& spanner_graph = SpannerGraph(g, spanner);
+  if (check_subgraph_disconnection(g, spanner_graph)) {
+    std::cerr << "Spanner disconnects a connected pair of a graph of size "
+      << args.graph_size << " and density " << args.graph_density
+      << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  StretchViolation violation;
+  if (!verify_stretch(g, spanner_graph, args.stretch_bound, &violation)) {
+    std::cerr << "Spanner violates stretch " << args.stretch_bound
+      << " on a graph of size " << args.graph_size << " and density "
+      << args.graph_density << ": the edge (" << violation.u << ", "
+      << violation.v << ") of weight " << violation.w
+      << " is at distance > " << violation.spanner_distance
+      << " in the spanner" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  return spanner;
+}
+
 template<typename SpannerAlg>
 json EdgeNumberExperiment(SpannerAlg&& alg, const ExperimentArgs& args ) {
   json result;
@@ -77,16 +171,20 @@ json EdgeNumberExperiment(SpannerAlg&& alg, const ExperimentArgs& args ) {
   result["num_runs"] = args.num_runs;
   long long running_spanner_edge_size = 0L;
   for (int i = 0; i < args.num_runs; ++i) {
-    auto g = randomGraph(args.graph_size, args.graph_density,
-        args.edge_weight);
-    auto spanner = alg(g);
-    assert(g.edges() >= spanner.edges());
-    running_spanner_edge_size += spanner.edges();
+    auto g = args.graph(i);
+    const long spanner_edges = SpannerEdges(BuildSpanner(alg, *g, args));
+    assert(g->edges() >= spanner_edges);
+    running_spanner_edge_size += spanner_edges;
   }
   result["average_spanner_size"] = running_spanner_edge_size / args.num_runs;
   return result;
 }
 
+// Returns the maximum stretch for g, s where s is a subgraph of g.
+double MaxStretch(const Graph& g, const Graph& s) {
+  return max_pair_stretch(g, s);
+}
+
 template<typename SpannerAlg>
 void CreateSpannerStretchReport(SpannerAlg&& alg,
     int start_size,
@@ -97,33 +195,10 @@ void CreateSpannerStretchReport(SpannerAlg&& alg,
     json res;
     res["size"] = graph_size;
     double running_stretch = 0.0;
-    auto skip_strech_pair = [&] (auto&& g_dst, auto&& s_dst) -> bool {
-      return g_dst == std::numeric_limits<double>::infinity() ||
-        g_dst == 0;
-    };
-
     for (int run = 0; run < how_many_runs; ++run) {
       auto g = randomGraph(graph_size);
       auto spanner = alg(g);
-      auto dsts_g = floydwarshall(g);
-      auto dsts_s = floydwarshall(spanner);
-      int stretches_considered = 0;
-      double max_stretch_for_g = 0.0;
-      for (int i = 0; i < g.size(); ++i) {
-        for(int j = i + 1; j < g.size(); ++j) {
-          if (skip_strech_pair(dsts_g[i][j], dsts_s[i][j]))
-            continue;
-          // Stretch factor for this pair:
-         if (dsts_s[i][j] == std::numeric_limits<double>::infinity()) {
-           assert(false);
-         }
-          auto stretch = dsts_s[i][j] / dsts_g[i][j];
-          assert(dsts_s[i][j] >= dsts_g[i][j]);
-          max_stretch_for_g = std::max(max_stretch_for_g, stretch);
-          ++stretches_considered;
-        }
-      }
-      running_stretch += max_stretch_for_g;
+      running_stretch += MaxStretch(g, spanner);
     }
     res["average_stretch"] = running_stretch / double(how_many_runs);
     return res;
@@ -138,48 +213,181 @@ void CreateSpannerStretchReport(SpannerAlg&& alg,
 }
 
 
-// Returns the maximum stretch for g, s where s is a subgraph of g.
-auto MaxStretch(const Graph& g, const Graph& s) {
-  auto dsts_g = floydwarshall(g);
-  auto dsts_s = floydwarshall(s);
-  double max_stretch = 0.0;
-  // If two vertices were disconnected in g, we don't check for them, since
-  // in such a case our algorithm would divide by \inf.
-  auto skip_strech_pair = [&] (auto&& g_dst, auto&& s_dst) -> bool {
-    return g_dst == std::numeric_limits<double>::infinity() ||
-      g_dst == 0;
-  };
-  for (int i = 0; i < g.size(); ++i) {
-    for(int j = i + 1; j < g.size(); ++j) {
-      if (skip_strech_pair(dsts_g[i][j], dsts_s[i][j]))
-        continue;
-      // Stretch factor for this pair:
-      if (dsts_s[i][j] == std::numeric_limits<double>::infinity()) {
-        assert(false);
-      }
-      auto stretch = dsts_s[i][j] / dsts_g[i][j];
-      assert(dsts_s[i][j] >= dsts_g[i][j]);
-      max_stretch = std::max(max_stretch, stretch);
+template<typename SpannerAlg>
+json MaxStretchExperiment(SpannerAlg&& alg, const ExperimentArgs& args ) {
+  json result;
+  result["size"] = args.graph_size;
+  result["k"] = args.k;
+  result["density"] = args.graph_density;
+  result["num_runs"] = args.num_runs;
+  if (!args.all_pairs_stretch) {
+    double max_stretch = 0.0;
+    for (int i = 0; i < args.num_runs; ++i) {
+      auto g = args.graph(i);
+      auto spanner = BuildSpanner(alg, *g, args);
+      max_stretch = std::max(max_stretch, max_edge_stretch(*g, spanner));
     }
+    result["max_stretch"] = max_stretch;
+    return result;
   }
-  return max_stretch;
+  PairStretchOptions options;
+  options.apsp_matrices = util::get_bool_flag("stretch_apsp_matrices");
+  options.single_precision = util::get_bool_flag("stretch_apsp_float");
+  options.packed = util::get_bool_flag("stretch_apsp_packed");
+  // The stats of all the runs' pairs together.
+  StretchStats stats;
+  for (int i = 0; i < args.num_runs; ++i) {
+    auto g = args.graph(i);
+    auto spanner = BuildSpanner(alg, *g, args);
+    if (args.edge_stretch_dump.empty()) {
+      stats.merge(pair_stretch_stats(*g, spanner, nullptr, options));
+      continue;
+    }
+    vector<EdgeStretch> edge_stretches;
+    stats.merge(pair_stretch_stats(*g, spanner, &edge_stretches, options));
+    ofstream dump(args.edge_stretch_dump + "_" +
+        std::to_string(args.graph_size) + "_" + std::to_string(i) + ".txt");
+    for (const auto& e : edge_stretches)
+      dump << e.u << " " << e.v << " " << e.w << " " << e.stretch << "\n";
+  }
+  result["max_stretch"] = stats.max;
+  result["mean_stretch"] = stats.mean();
+  result["pairs"] = stats.pairs();
+  result["disconnected_pairs"] = stats.histogram.infinite();
+  result["percentiles"] = {{"p50", stats.quantile(0.5)},
+    {"p90", stats.quantile(0.9)}, {"p99", stats.quantile(0.99)}};
+  // [stretch, number of pairs] for the non empty bins.
+  std::vector<json> histogram;
+  const auto& bins = stats.histogram.bins();
+  for (size_t bin = 0; bin < bins.size(); ++bin) {
+    if (bins[bin] > 0)
+      histogram.push_back({StretchHistogram::value_of(bin), bins[bin]});
+  }
+  result["stretch_histogram"] = histogram;
+  return result;
 }
 
 template<typename SpannerAlg>
-json MaxStretchExperiment(SpannerAlg&& alg, const ExperimentArgs& args ) {
+json StretchSampleExperiment(SpannerAlg&& alg, const ExperimentArgs& args) {
+  json result;
+  result["size"] = args.graph_size;
+  result["k"] = args.k;
+  result["density"] = args.graph_density;
+  result["num_runs"] = args.num_runs;
+  auto interval = [] (const Estimate& e) { return json({e.low, e.high}); };
+  std::vector<json> runs;
+  double running_average = 0.0;
+  for (int i = 0; i < args.num_runs; ++i) {
+    auto g = args.graph(i);
+    auto spanner = BuildSpanner(alg, *g, args);
+    auto options = args.sample_options;
+    options.seed += i;
+    auto estimate = sample_stretch(*g, spanner, options);
+    json run;
+    run["samples"] = estimate.samples;
+    run["pairs"] = estimate.pairs;
+    run["converged"] = estimate.converged;
+    run["average_stretch"] = estimate.average.value;
+    run["average_stretch_ci"] = interval(estimate.average);
+    json percentiles;
+    for (const auto& percentile : estimate.percentiles) {
+      std::ostringstream name;
+      name << "p" << percentile.first;
+      percentiles[name.str()] = {{"value", percentile.second.value},
+        {"ci", interval(percentile.second)}};
+    }
+    run["percentiles"] = percentiles;
+    runs.emplace_back(std::move(run));
+    running_average += estimate.average.value;
+  }
+  result["runs"] = runs;
+  result["average_stretch"] = running_average / args.num_runs;
+  return result;
+}
+
+// Builds the distance oracle of every run's graph from the cluster hierarchy
+// two_k_minus_1_spannerv2 samples, then times num_queries random queries (on
+// all threads) and measures the stretch of the first thousand of them.
+json OracleQueriesExperiment(const ExperimentArgs& args) {
+  constexpr int kCheckedQueries = 1000;
   json result;
   result["size"] = args.graph_size;
   result["k"] = args.k;
   result["density"] = args.graph_density;
   result["num_runs"] = args.num_runs;
-  double max_stretch = 0.0;
+  result["num_queries"] = args.num_queries;
+  double build_seconds = 0.0, query_seconds = 0.0, bunch_entries = 0.0;
+  double max_stretch = 0.0, running_stretch = 0.0;
+  double ch_build_seconds = 0.0, ch_query_seconds = 0.0, core_size = 0.0;
+  long checked = 0, ch_mismatches = 0;
   for (int i = 0; i < args.num_runs; ++i) {
-    auto g = randomGraph(args.graph_size, args.graph_density,
-        args.edge_weight);
-    auto spanner = alg(g);
-    max_stretch = std::max(max_stretch, MaxStretch(g, spanner));
+    auto g = args.graph(i);
+    auto start = util::Clock::now();
+    ClusterHierarchy hierarchy;
+    const auto spanner = two_k_minus_1_spannerv2(args.k, *g, &hierarchy);
+    DistanceOracle oracle(*g, hierarchy);
+    build_seconds += util::duration_cast<util::timeunit>(
+        util::Clock::now() - start).count();
+    bunch_entries += oracle.bunch_entries();
+
+    util::RandomEngine generator(args.sample_options.seed + i);
+    std::uniform_int_distribution<int> vertex(0, args.graph_size - 1);
+    vector<std::pair<int, int>> queries(args.num_queries);
+    for (auto& query : queries)
+      query = {vertex(generator), vertex(generator)};
+    vector<double> answers(queries.size());
+    start = util::Clock::now();
+    util::parallel_for(0, queries.size(), [&] (int, int q) {
+      answers[q] = oracle.query(queries[q].first, queries[q].second);
+    }, 1024);
+    query_seconds += util::duration_cast<util::timeunit>(
+        util::Clock::now() - start).count();
+
+    // Exact distances in the spanner, from its contraction hierarchy.
+    start = util::Clock::now();
+    ContractionHierarchy hierarchy_index(spanner);
+    ch_build_seconds += util::duration_cast<util::timeunit>(
+        util::Clock::now() - start).count();
+    core_size += hierarchy_index.core_size();
+    start = util::Clock::now();
+    const auto spanner_answers = hierarchy_index.distances(queries);
+    ch_query_seconds += util::duration_cast<util::timeunit>(
+        util::Clock::now() - start).count();
+
+    const CsrGraph csr(*g);
+    const CsrGraph spanner_csr(spanner);
+    DijkstraSearch search(args.graph_size);
+    for (int q = 0; q < std::min<int>(kCheckedQueries, queries.size()); ++q) {
+      const int target = queries[q].second;
+      search.run(csr, queries[q].first,
+          [target] (int v, double) { return v != target; });
+      const double exact = search.distance(target);
+      if (exact > 0 && !std::isinf(exact)) {
+        max_stretch = std::max(max_stretch, answers[q] / exact);
+        running_stretch += answers[q] / exact;
+        ++checked;
+      }
+      search.run(spanner_csr, queries[q].first,
+          [target] (int v, double) { return v != target; });
+      const double in_spanner = search.distance(target);
+      if (spanner_answers[q] != in_spanner &&
+          std::abs(spanner_answers[q] - in_spanner) > 1e-9 * in_spanner)
+        ++ch_mismatches;
+    }
   }
-  result["max_stretch"] = max_stretch;
+  result["average_build_seconds"] = build_seconds / args.num_runs;
+  result["queries_per_second"] =
+    double(args.num_queries) * args.num_runs / query_seconds;
+  result["average_bunch_size"] =
+    bunch_entries / args.num_runs / args.graph_size;
+  result["max_query_stretch"] = max_stretch;
+  result["average_query_stretch"] =
+    checked > 0 ? running_stretch / checked : 0.0;
+  result["ch_average_build_seconds"] = ch_build_seconds / args.num_runs;
+  result["ch_queries_per_second"] =
+    double(args.num_queries) * args.num_runs / ch_query_seconds;
+  result["ch_average_core_size"] = core_size / args.num_runs;
+  result["ch_mismatches"] = ch_mismatches;
   return result;
 }
 
@@ -196,7 +404,50 @@ void init(int argc, char** argv) {
       util::random_string(7));
   util::add_bool_flag("use_new_alg", "use the rewrite of baswana 2k-1 or not",
       true);
+  util::add_bool_flag("fused_three_spanner",
+      "compute 3-spanners in a single pass over the edges, without building "
+      "intermediate graphs", true);
+  util::add_string_flag("graph_cache_dir",
+      "If set, seeded random graphs are stored in (and loaded from) this "
+      "directory, see README for more info",
+      "");
+  util::add_int_flag("graph_cache_memory_mb",
+      "Approximate number of megabytes of shared random graphs kept in "
+      "memory, the least recently used ones are dropped first",
+      4096);
+  util::add_bool_flag("validate_spanners",
+      "Check that every spanner meets the stretch bound of its algorithm, "
+      "and exit at the first edge that violates it",
+      false);
+  util::add_bool_flag("stretch_apsp_matrices",
+      "Make the all_pairs stretch sweep compare all pairs distance matrices, "
+      "about n^2 doubles per graph, instead of searching a source at a time",
+      false);
+  util::add_bool_flag("stretch_apsp_float",
+      "With --stretch_apsp_matrices, use float matrices: half the memory, "
+      "about 7 significant digits",
+      false);
+  util::add_bool_flag("stretch_apsp_packed",
+      "With --stretch_apsp_matrices, store only the lower triangle of the "
+      "symmetric matrices, false stores them in full",
+      true);
+  util::add_int_flag("num_threads",
+      "Number of threads used by the parallel parts of a single experiment",
+      util::num_threads());
+  util::add_int_flag("hub_degree_threshold",
+      "Vertices with at least this many neighbors have their edges split "
+      "across threads in the 2k-1 spanners, 0 never splits them",
+      4096);
   util::parse_flags(argc, argv);
+  util::set_num_threads(util::get_int_flag("num_threads"));
+  const auto cache_dir = util::get_string_flag("graph_cache_dir");
+  if (!GraphCache::instance().set_directory(cache_dir)) {
+    std::cerr << "Could not create the graph cache directory " << cache_dir
+      << ": " << std::strerror(errno) << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  GraphCache::instance().set_capacity(
+      size_t(std::max(0, util::get_int_flag("graph_cache_memory_mb"))) << 20);
 }
 
 enum class  AlgorithmType {
@@ -209,18 +460,26 @@ enum class ExperimentType {
   EDGE_COUNT,
   MAX_STRETCH,
   DENSITY,
+  STRETCH_SAMPLE,
+  ORACLE_QUERIES,
 };
 
 ExperimentType TypeFromString(const string& type) {
   constexpr char kEdgeCount[] = "EdgeCount";
   constexpr char kMaxStretch[] = "MaxStretch";
   constexpr char kDensity[] = "Density";
+  constexpr char kStretchSample[] = "StretchSample";
+  constexpr char kOracleQueries[] = "OracleQueries";
   if (type == kEdgeCount)
     return ExperimentType::EDGE_COUNT;
   if (type == kMaxStretch)
     return ExperimentType::MAX_STRETCH;
   if (type == kDensity)
     return ExperimentType::DENSITY;
+  if (type == kStretchSample)
+    return ExperimentType::STRETCH_SAMPLE;
+  if (type == kOracleQueries)
+    return ExperimentType::ORACLE_QUERIES;
   std::cout << "Invalid experiment typename must be " << kEdgeCount << " or "
     << kMaxStretch;
   assert(false);
@@ -237,17 +496,26 @@ class Experimentor {
     static Experimentor CreateExperimentor(AlgorithmType alg_type,
         ExperimentType exp_type) {
       static auto three_span = [] (auto&& g) {return three_spanner(g);};
+      // Experiments that only count the edges take the spanner as a list.
+      static auto three_span_edges =
+        [] (auto&& g) {return three_spanner_edges(g);};
       switch (alg_type) {
         case AlgorithmType::THREE_SPANNER:
           switch (exp_type) {
             case ExperimentType::EDGE_COUNT: 
              return {[] (const ExperimentArgs& args) {
-               return EdgeNumberExperiment(three_spanner, args);
+               return EdgeNumberExperiment(three_span_edges, args);
              }};
             case ExperimentType::MAX_STRETCH:
              return { [] (const ExperimentArgs& args) -> json {
-               return MaxStretchExperiment(three_spanner, args);
+               return MaxStretchExperiment(three_span, args);
+             }};
+            case ExperimentType::STRETCH_SAMPLE:
+             return { [] (const ExperimentArgs& args) -> json {
+               return StretchSampleExperiment(three_span, args);
              }};
+            case ExperimentType::ORACLE_QUERIES:
+             return {OracleQueriesExperiment};
             default:
              cout << "unimplemented " << endl;
              assert(false);
@@ -270,13 +538,20 @@ class Experimentor {
                return MaxStretchExperiment([k=args.k] (auto&& g) {
                    return two_k_minus_1_spanner(k, g);}, args);
              }};
+            case ExperimentType::STRETCH_SAMPLE:
+             return {[] (const ExperimentArgs& args) {
+               return StretchSampleExperiment([k=args.k] (auto&& g) {
+                   return two_k_minus_1_spanner(k, g);}, args);
+             }};
+            case ExperimentType::ORACLE_QUERIES:
+             return {OracleQueriesExperiment};
           }
         case AlgorithmType::TWO_K_SPANNER2:
           switch (exp_type) {
             case ExperimentType::EDGE_COUNT: 
              return {[] (const ExperimentArgs& args) {
                return EdgeNumberExperiment([k=args.k] (auto&& g) {
-                   return two_k_minus_1_spannerv2(k, g);}, args);
+                   return two_k_minus_1_spannerv2_edges(k, g);}, args);
              }};
             case ExperimentType::MAX_STRETCH:
              return {[] (const ExperimentArgs& args) {
@@ -286,8 +561,15 @@ class Experimentor {
             case ExperimentType::DENSITY:
              return {[] (const ExperimentArgs& args) {
                return EdgeNumberExperiment([k=args.k] (auto&& g) {
+                   return two_k_minus_1_spannerv2_edges(k, g);}, args);
+             }};
+            case ExperimentType::STRETCH_SAMPLE:
+             return {[] (const ExperimentArgs& args) {
+               return StretchSampleExperiment([k=args.k] (auto&& g) {
                    return two_k_minus_1_spannerv2(k, g);}, args);
              }};
+            case ExperimentType::ORACLE_QUERIES:
+             return {OracleQueriesExperiment};
           }
       } 
     }
@@ -305,55 +587,128 @@ class ExperimentInfos {
     auto end() { return args.end();}
     ExperimentInfos(ExperimentType type, const json& exp_info) {
       auto weight_dist = edge_weight_from_exp(exp_info);
+      auto weight_name = edge_weight_name_from_exp(exp_info);
+      long long seed = exp_info.count("seed") != 0 ?
+        static_cast<long long>(exp_info["seed"]) : -1;
+      bool all_pairs_stretch = exp_info.count("stretch_method") != 0 &&
+        exp_info["stretch_method"] == "all_pairs";
       switch (type) {
         case ExperimentType::DENSITY:
           for (auto&& density : exp_info["densities"]) {
             args.emplace_back(exp_info["size"], density, exp_info["k"],
                 exp_info["num_runs_per_size"]);
-            args.back().edge_weight = edge_weight_from_exp(exp_info); 
           }
           break;
         case ExperimentType::EDGE_COUNT:
         case ExperimentType::MAX_STRETCH:
+        case ExperimentType::STRETCH_SAMPLE:
+        case ExperimentType::ORACLE_QUERIES:
           for (auto&& size : exp_info["sizes"]) {
             args.emplace_back(size, exp_info);
-            args.back().edge_weight = edge_weight_from_exp(exp_info); 
           }
           break;
       }
+      for (auto& arg : args) {
+        arg.edge_weight = weight_dist;
+        arg.edge_weight_name = weight_name;
+        arg.seed = seed;
+        arg.all_pairs_stretch = all_pairs_stretch;
+        if (exp_info.count("edge_stretch_dump") != 0)
+          arg.edge_stretch_dump = exp_info["edge_stretch_dump"];
+        arg.sample_options = sample_options_from_exp(exp_info);
+        if (exp_info.count("num_queries") != 0)
+          arg.num_queries = exp_info["num_queries"];
+      }
+      if (exp_info.count("coupled") != 0 && bool(exp_info["coupled"])) {
+        couple_args(weight_dist, seed);
+      }
     }
 
   private:
   std::vector<ExperimentArgs> args; 
-  std::function<double(void)> edge_weight_from_exp(const json& exp_info) {
+
+  StretchSampleOptions sample_options_from_exp(const json& exp_info) {
+    StretchSampleOptions options;
+    options.sample_pairs = exp_info.count("sampling") != 0 &&
+      exp_info["sampling"] == "pairs";
+    if (exp_info.count("confidence") != 0)
+      options.confidence = exp_info["confidence"];
+    if (exp_info.count("target_precision") != 0)
+      options.target_precision = exp_info["target_precision"];
+    if (exp_info.count("percentiles") != 0)
+      options.percentiles = exp_info["percentiles"].get<vector<double>>();
+    if (exp_info.count("min_samples") != 0)
+      options.min_samples = exp_info["min_samples"];
+    if (exp_info.count("max_samples") != 0)
+      options.max_samples = exp_info["max_samples"];
+    options.seed = exp_info.count("seed") != 0 ?
+      static_cast<unsigned long>(exp_info["seed"]) : std::random_device{}();
+    return options;
+  }
+
+  // Makes all the points of the sweep share one CoupledGraphs draw.
+  void couple_args(const EdgeWeightSampler& edge_weight, long long seed) {
+    int max_size = 0;
+    double max_density = 0.0;
+    for (const auto& arg : args) {
+      max_size = std::max(max_size, arg.graph_size);
+      max_density = std::max(max_density, arg.graph_density);
+    }
+    auto coupled = std::make_shared<CoupledGraphs>(max_size, max_density,
+        args.size(), edge_weight, seed);
+    for (auto& arg : args) {
+      arg.coupled = coupled;
+    }
+  }
+  EdgeWeightSampler edge_weight_from_exp(const json& exp_info) {
     if (exp_info.count("edge_weight_distribution") == 0)
-      return util::random_real;
+      return [] (util::RandomEngine& generator) {
+        return std::uniform_real_distribution<double>(0, 1)(generator);
+      };
     const auto& type_name = exp_info["edge_weight_distribution"];
+    if (type_name == "unit") {
+      return [] (util::RandomEngine&) -> double { return 1.0; };
+    }
     if (type_name == "exponential") {
       double mean = exp_info.count("mean") ? double(exp_info["mean"]) : 0.05;
-      return [mean] () -> double {
-        static std::minstd_rand0 generator(std::time(0));
-        static std::exponential_distribution<double> dst(mean);
-        return dst(generator);
+      return [mean] (util::RandomEngine& generator) -> double {
+        return std::exponential_distribution<double>(mean)(generator);
       };
     }
     if (type_name == "gamma") {
-      return [] () -> double {
-        static std::minstd_rand0 generator(std::time(0));
-        static std::gamma_distribution<double> dst;
-        return dst(generator);
+      return [] (util::RandomEngine& generator) -> double {
+        return std::gamma_distribution<double>()(generator);
       };
     }
     if (type_name == "weibull") {
-      return [] () -> double {
-        static std::minstd_rand0 generator(std::time(0));
-        static std::weibull_distribution<double> dst;
-        return dst(generator);
+      return [] (util::RandomEngine& generator) -> double {
+        return std::weibull_distribution<double>()(generator);
+      };
+    }
+    if (type_name == "empirical") {
+      auto sampler = std::make_shared<const util::AliasSampler>(
+          util::AliasSampler::FromFile(exp_info["weights_file"]));
+      return [sampler] (util::RandomEngine& generator) -> double {
+        return (*sampler)(generator);
       };
     }
     cout << "Unrecognized edge_weight_distribution " << type_name << endl;
     assert(false);
   }
+
+  // A name that identifies the distribution returned by edge_weight_from_exp.
+  string edge_weight_name_from_exp(const json& exp_info) {
+    if (exp_info.count("edge_weight_distribution") == 0)
+      return "uniform";
+    string name = exp_info["edge_weight_distribution"];
+    if (name == "exponential") {
+      double mean = exp_info.count("mean") ? double(exp_info["mean"]) : 0.05;
+      name += ":" + std::to_string(mean);
+    } else if (name == "empirical") {
+      name += ":" + exp_info["weights_file"].get<string>();
+    }
+    return name;
+  }
 };
 
 string output_file(const string& filename) {
@@ -370,11 +725,31 @@ string output_file(const string& filename) {
 }
 
 
+// The stretch a spanner built by alg_type is guaranteed to have.
+double StretchBound(AlgorithmType alg_type, int k) {
+  return alg_type == AlgorithmType::THREE_SPANNER ? 3 : 2 * k - 1;
+}
+
 void ConductExperiments(const json& experiment_config,
     const string& report_suffix, AlgorithmType alg_type) {
-  auto experiment_conductor = [&report_suffix] (auto&& exp_func,
+  auto experiment_conductor = [&report_suffix, alg_type] (auto&& exp_func,
       int experiment_index, auto&& exp_info, auto&& type) {
     ExperimentInfos experiments(type, exp_info);
+    for (auto&& experiment_args : experiments) {
+      // The oracle is built from the 2k-1 clustering whatever the algorithm,
+      // a 3_spanner file gets the k = 2 oracle, whose stretch is also 3.
+      if (type == ExperimentType::ORACLE_QUERIES && experiment_args.k < 1 &&
+          alg_type == AlgorithmType::THREE_SPANNER) {
+        experiment_args.k = 2;
+      }
+      if (experiment_args.k < 1 && (type == ExperimentType::ORACLE_QUERIES ||
+            alg_type != AlgorithmType::THREE_SPANNER)) {
+        std::cerr << "Experiment " << experiment_index << " needs a \"k\" of "
+          "at least 1, got " << experiment_args.k << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      experiment_args.stretch_bound = StretchBound(alg_type, experiment_args.k);
+    }
     std::vector<std::future<json>> futures; 
     for (auto&& experiment_args : experiments) {
       futures.emplace_back(std::async(exp_func, experiment_args));
@@ -0,0 +1,381 @@
+#include "shortest_paths.h"
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include "util.h"
+
+namespace graphs {
+namespace {
+  // Measured on a single AVX-512 core: a heap ordered relaxation of Dijkstra
+  // (per log n) and a min-plus update of the blocked Floyd-Warshall.
+  constexpr double kDijkstraNanosPerRelaxation = 2.0;
+  constexpr double kFloydWarshallNanosPerUpdate = 0.13;
+
+  template<typename T>
+  DistanceMatrix<T> dijkstra_apsp(const Graph& g, bool packed) {
+    const CsrGraph csr(g);
+    constexpr int B = DistanceMatrix<T>::kBlock;
+    DistanceMatrix<T> dists(g.size(), packed);
+    dists.fill(std::numeric_limits<T>::infinity());
+    std::vector<DijkstraSearch> searches(util::num_threads(),
+        DijkstraSearch(g.size()));
+    util::parallel_for(0, g.size(), [&] (int worker, int src) {
+      // Every source fills its row. A packed matrix is symmetric, so there a
+      // source only fills its part of the lower triangle (and its mirror in
+      // the diagonal tiles) and no entry is written twice.
+      searches[worker].run(csr, src, [&] (int v, double d) {
+        if (!packed) {
+          dists.at(src, v) = d;
+        } else if (v <= src) {
+          dists.at(src, v) = d;
+          if (v / B == src / B)
+            dists.at(v, src) = d;
+        }
+        return true;
+      });
+    });
+    return dists;
+  }
+
+  // Graphs with fewer (directed) edges are searched on one thread.
+  constexpr long kMinParallelSsspEdges = 1 << 16;
+
+  // Non negative doubles compare like their bit patterns as unsigned integers.
+  uint64_t distance_bits(double d) {
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    return bits;
+  }
+
+  double bits_distance(uint64_t bits) {
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    return d;
+  }
+
+  // A monotone priority queue: keys pushed are never smaller than the last
+  // one popped. An entry sits in the bucket of the highest bit in which its
+  // key differs from the last popped key, and moves to lower buckets only when
+  // its bucket is the first non empty one, so it moves at most 64 times.
+  class RadixHeap {
+    public:
+      bool empty() const { return count == 0; }
+
+      void push(uint64_t key, int v) {
+        buckets[bucket_of(key)].emplace_back(key, v);
+        ++count;
+      }
+
+      std::pair<uint64_t, int> pop() {
+        if (buckets[0].empty()) {
+          int first = 1;
+          while (buckets[first].empty())
+            ++first;
+          auto& bucket = buckets[first];
+          last = bucket.front().first;
+          for (const auto& entry : bucket)
+            last = std::min(last, entry.first);
+          for (const auto& entry : bucket)
+            buckets[bucket_of(entry.first)].push_back(entry);
+          bucket.clear();
+        }
+        auto top = buckets[0].back();
+        buckets[0].pop_back();
+        --count;
+        return top;
+      }
+
+    private:
+      int bucket_of(uint64_t key) const {
+        return key == last ? 0 : 64 - __builtin_clzll(key ^ last);
+      }
+
+      std::array<std::vector<std::pair<uint64_t, int>>, 65> buckets;
+      uint64_t last = 0;
+      size_t count = 0;
+  };
+
+  // Rounds over all the edges until one relaxes nothing, which takes as many
+  // rounds as the most hops of a shortest path (at most n - 1).
+  std::vector<double> bellman_ford(const CsrGraph& g, int src) {
+    std::vector<double> dist(g.size(), std::numeric_limits<double>::infinity());
+    dist[src] = 0;
+    // Without negative cycles, n - 1 rounds relax every shortest path.
+    for (int round = 1; round < g.size(); ++round) {
+      bool changed = false;
+      for (int v = 0; v < g.size(); ++v) {
+        if (std::isinf(dist[v]))
+          continue;
+        for (const auto& e : g.neighbors(v)) {
+          if (dist[v] + e.w < dist[e.end]) {
+            dist[e.end] = dist[v] + e.w;
+            changed = true;
+          }
+        }
+      }
+      if (!changed)
+        break;
+    }
+    return dist;
+  }
+
+  bool has_negative_weight(const CsrGraph& g) {
+    for (int v = 0; v < g.size(); ++v)
+      for (const auto& e : g.neighbors(v))
+        if (e.w < 0)
+          return true;
+    return false;
+  }
+
+  std::vector<double> radix_heap_dijkstra(const CsrGraph& g, int src) {
+    std::vector<double> dist(g.size(), std::numeric_limits<double>::infinity());
+    RadixHeap heap;
+    dist[src] = 0;
+    heap.push(distance_bits(0), src);
+    while (!heap.empty()) {
+      const auto top = heap.pop();
+      const double d = bits_distance(top.first);
+      const int v = top.second;
+      if (d > dist[v])
+        continue;
+      for (const auto& e : g.neighbors(v)) {
+        if (d + e.w < dist[e.end]) {
+          dist[e.end] = d + e.w;
+          heap.push(distance_bits(dist[e.end]), e.end);
+        }
+      }
+    }
+    return dist;
+  }
+
+  // A barrier for the threads of one parallel_for, every one of which must
+  // reach it.
+  class Barrier {
+    public:
+      explicit Barrier(int threads): threads(threads) {}
+
+      void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        const long arrival = generation;
+        if (++arrived == threads) {
+          arrived = 0;
+          ++generation;
+          all_arrived.notify_all();
+          return;
+        }
+        all_arrived.wait(lock, [&] { return generation != arrival; });
+      }
+
+    private:
+      const int threads;
+      int arrived = 0;
+      long generation = 0;
+      std::mutex mutex;
+      std::condition_variable all_arrived;
+  };
+
+  // Vertices handed to a thread at a time when relaxing a bucket.
+  constexpr size_t kRelaxGrain = 64;
+
+  // Meyer and Sanders' delta-stepping. The vertices with a tentative distance
+  // in [i * delta, (i + 1) * delta) form bucket i. The current bucket is
+  // settled by rounds that relax the light edges (of weight <= delta) of its
+  // vertices in parallel, since they may put vertices back in it, and the
+  // heavy edges of all the vertices it held are relaxed once at the end.
+  // Distances are lowered by an atomic min on their bits; every worker keeps
+  // the vertices it lowered and they are put in their buckets between rounds.
+  // The tentative distances are below the current bucket's plus
+  // max_weight + delta, so the buckets are a cyclic array of that many, and
+  // delta is at least max_weight / n so that there are at most n + 3 of
+  // them. The threads are started once and meet at a barrier around every
+  // round, where worker 0 fills the buckets and picks the round's vertices.
+  std::vector<double> delta_stepping(const CsrGraph& g, int src, double delta) {
+    const int n = g.size();
+    const double inf = std::numeric_limits<double>::infinity();
+    double max_weight = 0;
+    for (int v = 0; v < n; ++v)
+      for (const auto& e : g.neighbors(v))
+        max_weight = std::max(max_weight, e.w);
+    if (delta <= 0) {
+      const double average_degree = std::max(1.0, double(g.edges()) / n);
+      delta = max_weight > 0 ? max_weight / average_degree : 1.0;
+    }
+    delta = std::max(delta, max_weight / n);
+    std::vector<std::atomic<uint64_t>> dist(n);
+    for (int v = 0; v < n; ++v)
+      dist[v].store(distance_bits(inf), std::memory_order_relaxed);
+    auto distance = [&] (int v) {
+      return bits_distance(dist[v].load(std::memory_order_relaxed));
+    };
+    auto lower = [&] (int v, double d) {
+      const uint64_t bits = distance_bits(d);
+      uint64_t current = dist[v].load(std::memory_order_relaxed);
+      while (bits < current) {
+        if (dist[v].compare_exchange_weak(current, bits,
+              std::memory_order_relaxed))
+          return true;
+      }
+      return false;
+    };
+    auto bucket_of = [delta] (double d) { return size_t(d / delta); };
+
+    const size_t num_buckets = size_t(max_weight / delta) + 3;
+    std::vector<std::vector<int>> buckets(num_buckets);
+    auto bucket = [&] (size_t i) -> std::vector<int>& {
+      return buckets[i % num_buckets];
+    };
+    bucket(0).push_back(src);
+    dist[src].store(distance_bits(0), std::memory_order_relaxed);
+    const int team = util::in_parallel_for() ? 1 : util::num_threads();
+    std::vector<std::vector<int>> lowered(team);
+    // The round (or bucket) in which a vertex was last added to frontier (or
+    // settled), so a vertex is not added twice.
+    std::vector<long> in_frontier(n, -1), in_settled(n, -1);
+    std::vector<int> frontier, settled, heavy;
+    long round = 0;
+    size_t current = 0;
+
+    // What the team relaxes next, null once every bucket is empty, and
+    // whether it relaxes the light edges or the heavy ones.
+    const std::vector<int>* work = nullptr;
+    bool light = true;
+    // Puts the vertices lowered by the last round in their buckets and picks
+    // the next round.
+    auto plan = [&] {
+      for (auto& worker_lowered : lowered) {
+        for (int v : worker_lowered)
+          bucket(bucket_of(distance(v))).push_back(v);
+        worker_lowered.clear();
+      }
+      while (true) {
+        auto& entries = bucket(current);
+        if (!entries.empty()) {
+          ++round;
+          frontier.clear();
+          for (int v : entries) {
+            // Skip the entries of vertices that moved to a lower bucket since.
+            if (bucket_of(distance(v)) != current || in_frontier[v] == round)
+              continue;
+            in_frontier[v] = round;
+            frontier.push_back(v);
+            if (in_settled[v] != long(current)) {
+              in_settled[v] = current;
+              settled.push_back(v);
+            }
+          }
+          entries.clear();
+          if (!frontier.empty()) {
+            work = &frontier;
+            light = true;
+            return;
+          }
+          continue;
+        }
+        if (!settled.empty()) {
+          heavy.swap(settled);
+          settled.clear();
+          work = &heavy;
+          light = false;
+          return;
+        }
+        size_t next = current + 1;
+        while (next < current + num_buckets && bucket(next).empty())
+          ++next;
+        if (next == current + num_buckets) {
+          work = nullptr;
+          return;
+        }
+        current = next;
+      }
+    };
+
+    Barrier barrier(team);
+    std::atomic<size_t> next_vertex(0);
+    // 'team' indices for as many threads, each of which keeps its index
+    // until the end, so every thread of the team takes exactly one.
+    util::parallel_for(0, team, [&] (int worker, int) {
+      while (true) {
+        if (worker == 0) {
+          plan();
+          next_vertex.store(0, std::memory_order_relaxed);
+        }
+        barrier.wait();
+        if (!work)
+          return;
+        const auto& vertices = *work;
+        for (size_t first = next_vertex.fetch_add(kRelaxGrain);
+            first < vertices.size();
+            first = next_vertex.fetch_add(kRelaxGrain)) {
+          const size_t last = std::min(vertices.size(), first + kRelaxGrain);
+          for (size_t i = first; i < last; ++i) {
+            const int v = vertices[i];
+            const double d = distance(v);
+            for (const auto& e : g.neighbors(v)) {
+              if ((e.w <= delta) == light && lower(e.end, d + e.w))
+                lowered[worker].push_back(e.end);
+            }
+          }
+        }
+        barrier.wait();
+      }
+    });
+    std::vector<double> result(n);
+    for (int v = 0; v < n; ++v)
+      result[v] = distance(v);
+    return result;
+  }
+}  // namespace
+
+std::vector<double> sssp(const CsrGraph& g, int src, SsspAlgorithm algorithm,
+    double delta) {
+  if (algorithm == SsspAlgorithm::AUTO) {
+    const bool parallel = util::num_threads() > 1 && !util::in_parallel_for()
+      && g.edges() >= kMinParallelSsspEdges;
+    algorithm = has_negative_weight(g) ? SsspAlgorithm::BELLMAN_FORD :
+      parallel ? SsspAlgorithm::DELTA_STEPPING :
+      SsspAlgorithm::RADIX_HEAP_DIJKSTRA;
+  }
+  switch (algorithm) {
+    case SsspAlgorithm::DELTA_STEPPING:
+      return delta_stepping(g, src, delta);
+    case SsspAlgorithm::BELLMAN_FORD:
+      return bellman_ford(g, src);
+    default:
+      return radix_heap_dijkstra(g, src);
+  }
+}
+
+std::vector<double> sssp(const Graph& g, int src, SsspAlgorithm algorithm,
+    double delta) {
+  return sssp(CsrGraph(g), src, algorithm, delta);
+}
+
+ApspAlgorithm choose_apsp_algorithm(const Graph& g) {
+  const double n = g.size();
+  const double m = g.edges();
+  const double dijkstra = kDijkstraNanosPerRelaxation * n * (m + n) *
+    std::log2(std::max(2.0, n));
+  const double floyd_warshall = kFloydWarshallNanosPerUpdate * n * n * n;
+  return dijkstra < floyd_warshall ? ApspAlgorithm::DIJKSTRA :
+    ApspAlgorithm::FLOYD_WARSHALL;
+}
+
+template<typename T>
+DistanceMatrix<T> all_pairs_shortest_paths(const Graph& g,
+    ApspAlgorithm algorithm, bool packed) {
+  if (algorithm == ApspAlgorithm::AUTO)
+    algorithm = choose_apsp_algorithm(g);
+  if (algorithm == ApspAlgorithm::DIJKSTRA)
+    return dijkstra_apsp<T>(g, packed);
+  return blocked_floydwarshall<T>(g, packed);
+}
+
+template DistanceMatrix<float> all_pairs_shortest_paths(const Graph&,
+    ApspAlgorithm, bool);
+template DistanceMatrix<double> all_pairs_shortest_paths(const Graph&,
+    ApspAlgorithm, bool);
+}  // namespace graphs
@@ -0,0 +1,198 @@
+#ifndef SHORTEST_PATHS_H
+#define SHORTEST_PATHS_H
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "csr_graph.h"
+#include "floyd_warshall.h"
+
+namespace graphs {
+  // Reusable state for Dijkstra searches on a graph with n vertices, a
+  // CsrGraph or any other type whose neighbors(v) is a range of Edge. Only
+  // the entries a search touched are reset by the next one, so running many
+  // short searches (e.g one per edge) costs only what they explore and not
+  // O(n) each. A DijkstraSearch must not be shared between threads.
+  class DijkstraSearch {
+    public:
+      explicit DijkstraSearch(int n):
+        dist(n, std::numeric_limits<double>::infinity()) {}
+
+      // Settles the vertices of g in order of their distance from src and calls
+      // visit(v, distance) for each. The search stops once visit returns false
+      // or every vertex at distance at most 'bound' was settled.
+      template<typename G, typename Visit>
+      void run(const G& g, int src, Visit&& visit,
+          double bound = std::numeric_limits<double>::infinity()) {
+        search(g, src, [] (int, double) { return true; }, visit, bound);
+      }
+
+      // Like run, but a vertex v reached at distance d is only kept (and
+      // later settled and expanded) if keep(v, d). So only the vertices whose
+      // shortest path from src is kept all the way are settled, e.g the
+      // clusters of a distance oracle.
+      template<typename G, typename Keep, typename Visit>
+      void run_pruned(const G& g, int src, Keep&& keep, Visit&& visit) {
+        search(g, src, keep, visit, std::numeric_limits<double>::infinity());
+      }
+
+      int size() const { return dist.size(); }
+
+      // The distance found by the last run, exact for the vertices it settled,
+      // infinity for the vertices it did not reach.
+      double distance(int v) const { return dist[v]; }
+
+    private:
+      using Entry = std::pair<double, int>;
+
+      template<typename G, typename Keep, typename Visit>
+      void search(const G& g, int src, Keep&& keep, Visit&& visit,
+          double bound) {
+        reset();
+        relax(src, 0);
+        while (!heap.empty()) {
+          std::pop_heap(std::begin(heap), std::end(heap), std::greater<Entry>());
+          const auto top = heap.back();
+          heap.pop_back();
+          const double d = top.first;
+          const int v = top.second;
+          // Stale entry, v was reached by a shorter path after it was pushed.
+          if (d > dist[v])
+            continue;
+          if (d > bound || !visit(v, d))
+            break;
+          for (const auto& e : g.neighbors(v)) {
+            if (keep(e.end, d + e.w))
+              relax(e.end, d + e.w);
+          }
+        }
+      }
+
+      void relax(int v, double d) {
+        if (d < dist[v]) {
+          if (dist[v] == std::numeric_limits<double>::infinity())
+            touched.push_back(v);
+          dist[v] = d;
+          heap.emplace_back(d, v);
+          std::push_heap(std::begin(heap), std::end(heap), std::greater<Entry>());
+        }
+      }
+
+      void reset() {
+        for (int v : touched)
+          dist[v] = std::numeric_limits<double>::infinity();
+        touched.clear();
+        heap.clear();
+      }
+
+      std::vector<double> dist;
+      std::vector<int> touched;
+      std::vector<Entry> heap;
+  };
+
+  // Breadth first searches from up to 64 sources at once, ignoring the
+  // weights. Bit j of a vertex' word says whether source j reached it, so a
+  // level of all the searches costs one scan of the edges, OR-ing the words of
+  // the neighbors. A BitParallelBfs must not be shared between threads.
+  class BitParallelBfs {
+    public:
+      static constexpr int kMaxSources = 64;
+
+      explicit BitParallelBfs(int n): seen(n), frontier(n), next(n) {}
+
+      // Calls visit(v, bits, hops) for every vertex v with the bits of the
+      // sources that first reach it 'hops' edges away (sources[j] has bit j,
+      // and is visited with hops = 0).
+      template<typename G, typename Visit>
+      void run(const G& g, const std::vector<int>& sources, Visit&& visit) {
+        const int n = seen.size();
+        std::fill(std::begin(seen), std::end(seen), 0);
+        std::fill(std::begin(frontier), std::end(frontier), 0);
+        const uint64_t all = sources.size() == kMaxSources ? ~uint64_t(0) :
+          (uint64_t(1) << sources.size()) - 1;
+        for (size_t j = 0; j < sources.size(); ++j)
+          frontier[sources[j]] |= uint64_t(1) << j;
+        for (int v = 0; v < n; ++v) {
+          if (frontier[v]) {
+            seen[v] = frontier[v];
+            visit(v, frontier[v], 0);
+          }
+        }
+        for (int hops = 1; ; ++hops) {
+          bool reached = false;
+          for (int v = 0; v < n; ++v) {
+            uint64_t bits = 0;
+            if (seen[v] != all) {
+              for (const auto& e : g.neighbors(v))
+                bits |= frontier[e.end];
+              bits &= ~seen[v];
+            }
+            next[v] = bits;
+            reached |= bits != 0;
+          }
+          if (!reached)
+            break;
+          for (int v = 0; v < n; ++v) {
+            if (next[v]) {
+              seen[v] |= next[v];
+              visit(v, next[v], hops);
+            }
+          }
+          std::swap(frontier, next);
+        }
+      }
+
+      // The sources that reached v in the last run.
+      uint64_t reached(int v) const { return seen[v]; }
+
+    private:
+      std::vector<uint64_t> seen;
+      std::vector<uint64_t> frontier;
+      std::vector<uint64_t> next;
+  };
+
+  enum class SsspAlgorithm {
+    AUTO,
+    // Buckets of width delta whose vertices are relaxed in parallel.
+    DELTA_STEPPING,
+    // Dijkstra with a radix heap on the bits of the distances.
+    RADIX_HEAP_DIJKSTRA,
+    // Rounds over all the edges, stopping at the first one that relaxes
+    // nothing. The only one that allows negative weights (without negative
+    // cycles, so only in a directed CsrGraph).
+    BELLMAN_FORD,
+  };
+
+  // Distances from src to every vertex of g (infinity if unreachable). AUTO
+  // runs Bellman-Ford if g has a negative weight, else delta-stepping on large
+  // graphs when threads are available (i.e not from inside a parallel_for) and
+  // the radix heap Dijkstra otherwise. 'delta' is the bucket width of
+  // delta-stepping, 0 picks the heaviest weight over the average degree, and
+  // it is never below the heaviest weight over n.
+  std::vector<double> sssp(const CsrGraph& g, int src,
+      SsspAlgorithm algorithm = SsspAlgorithm::AUTO, double delta = 0);
+  std::vector<double> sssp(const Graph& g, int src,
+      SsspAlgorithm algorithm = SsspAlgorithm::AUTO, double delta = 0);
+
+  enum class ApspAlgorithm {
+    AUTO,
+    DIJKSTRA,
+    FLOYD_WARSHALL,
+  };
+
+  // Returns the algorithm all_pairs_shortest_paths expects to be faster for g:
+  // n Dijkstra runs cost about n * (m + n) * log n, the blocked
+  // Floyd-Warshall about n^3 but with a much smaller constant.
+  ApspAlgorithm choose_apsp_algorithm(const Graph& g);
+
+  // All pairs shortest paths of g as a packed (symmetric, half the memory) or
+  // full matrix of T (float or double), computed by 'algorithm', AUTO picks it
+  // per graph with choose_apsp_algorithm. Dijkstra runs in parallel over the
+  // sources with one DijkstraSearch per thread.
+  template<typename T = double>
+  DistanceMatrix<T> all_pairs_shortest_paths(const Graph& g,
+      ApspAlgorithm algorithm = ApspAlgorithm::AUTO, bool packed = true);
+}  // namespace graphs
+#endif
@@ -0,0 +1,62 @@
+#ifndef SPARSE_ACCUMULATOR_H
+#define SPARSE_ACCUMULATOR_H
+#include <functional>
+#include <vector>
+
+namespace graphs {
+  // A map from the keys [0, n) to values of T, for loops that touch a few
+  // keys at a time, e.g the cluster -> lightest edge map of every vertex: a
+  // dense array of values plus the list of keys set since the last clear(),
+  // which costs only what was touched. Kept across the iterations of a loop
+  // (one per thread), it replaces a fresh hash map per iteration.
+  template<typename T>
+  class SparseAccumulator {
+    public:
+      SparseAccumulator() {}
+      // 'empty' fills the unused slots, T need not be default constructible.
+      SparseAccumulator(int n, const T& empty):
+        values(n, empty), present(n, 0) {}
+
+      int size() const { return values.size(); }
+      // Makes room for the keys [0, n) if there is less, so one accumulator
+      // can serve graphs of different sizes.
+      void grow(int n, const T& empty) {
+        if (n > size()) {
+          values.resize(n, empty);
+          present.resize(n, 0);
+        }
+      }
+
+      // Sets the value of 'key' to 'value' if it has none or if
+      // less(value, current value).
+      template<typename Less = std::less<T>>
+      void min(int key, const T& value, Less&& less = Less()) {
+        if (!present[key]) {
+          present[key] = 1;
+          keys_.push_back(key);
+          values[key] = value;
+        } else if (less(value, values[key])) {
+          values[key] = value;
+        }
+      }
+
+      bool contains(int key) const { return present[key]; }
+      // The value of a key that has one.
+      const T& operator[](int key) const { return values[key]; }
+      // The keys that have a value, in the order they got it.
+      const std::vector<int>& keys() const { return keys_; }
+      bool empty() const { return keys_.empty(); }
+
+      void clear() {
+        for (int key : keys_)
+          present[key] = 0;
+        keys_.clear();
+      }
+
+    private:
+      std::vector<T> values;
+      std::vector<char> present;
+      std::vector<int> keys_;
+  };
+}  // namespace graphs
+#endif
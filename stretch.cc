@@ -0,0 +1,590 @@
+#include "stretch.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <vector>
+#include "csr_graph.h"
+#include "shortest_paths.h"
+#include "util.h"
+
+namespace graphs {
+double max_edge_stretch(const Graph& g, const Graph& spanner) {
+  const CsrGraph s(spanner);
+  struct Worker {
+    DijkstraSearch search;
+    // target_weight[v] is w(u, v) while v is a target of the current source.
+    std::vector<double> target_weight;
+    std::vector<int> targets;
+    double max_stretch = 0.0;
+    explicit Worker(int n): search(n), target_weight(n, -1) {}
+  };
+  std::vector<Worker> workers(util::num_threads(), Worker(g.size()));
+  util::parallel_for(0, g.size(), [&] (int worker, int u) {
+    auto& state = workers[worker];
+    auto& targets = state.targets;
+    targets.clear();
+    for (const auto& e : g.neighbors(u)) {
+      // Edges of weight 0 have no stretch, edges in the spanner have stretch
+      // at most 1.
+      if (e.w > 0)
+        state.max_stretch = std::max(state.max_stretch, 1.0);
+      if (u < e.end && e.w > 0 && !spanner.has_edge(u, e.end)) {
+        state.target_weight[e.end] = e.w;
+        targets.push_back(e.end);
+      }
+    }
+    if (targets.empty())
+      return;
+    auto remaining = targets.size();
+    state.search.run(s, u, [&] (int v, double d) {
+      if (state.target_weight[v] > 0) {
+        state.max_stretch = std::max(state.max_stretch,
+            d / state.target_weight[v]);
+        --remaining;
+      }
+      return remaining > 0;
+    });
+    // Targets that were never settled are disconnected from u in the spanner.
+    if (remaining > 0) {
+      state.max_stretch = std::numeric_limits<double>::infinity();
+    }
+    for (int v : targets)
+      state.target_weight[v] = -1;
+  }, 64);
+  double max_stretch = 0.0;
+  for (const auto& state : workers)
+    max_stretch = std::max(max_stretch, state.max_stretch);
+  return max_stretch;
+}
+
+bool verify_stretch(const Graph& g, const Graph& spanner, double bound,
+    StretchViolation* violation) {
+  // Stretches of exactly 'bound' must not fail on rounding.
+  const double tolerance = bound * (1 + 1e-9);
+  const CsrGraph s(spanner);
+  struct Worker {
+    DijkstraSearch search;
+    std::vector<bool> is_target;
+    // The edges (u, v > u) of g missing from the spanner, sorted by weight.
+    std::vector<Edge> targets;
+    explicit Worker(int n): search(n), is_target(n, false) {}
+  };
+  std::vector<Worker> workers(util::num_threads(), Worker(g.size()));
+  std::atomic<bool> failed(false);
+  util::parallel_for(0, g.size(), [&] (int worker, int u) {
+    if (failed.load(std::memory_order_relaxed))
+      return;
+    auto& state = workers[worker];
+    auto& targets = state.targets;
+    targets.clear();
+    for (const auto& e : g.neighbors(u)) {
+      if (u < e.end && !spanner.has_edge(u, e.end)) {
+        targets.push_back(e);
+        state.is_target[e.end] = true;
+      }
+    }
+    if (targets.empty())
+      return;
+    std::sort(std::begin(targets), std::end(targets));
+    // targets[next] is the lightest target not settled yet. A target settled
+    // before the search passed bound times that weight is covered, since its
+    // own weight is at least that.
+    size_t next = 0;
+    double reached = std::numeric_limits<double>::infinity();
+    state.search.run(s, u, [&] (int v, double d) {
+      if (d > tolerance * targets[next].w) {
+        reached = d;
+        return false;
+      }
+      state.is_target[v] = false;
+      while (next < targets.size() && !state.is_target[targets[next].end])
+        ++next;
+      return next < targets.size();
+    });
+    if (next < targets.size()) {
+      // The search either passed the bound of targets[next], or ran out of
+      // vertices without reaching it.
+      // Only the first worker to fail writes the violation.
+      if (!failed.exchange(true) && violation)
+        *violation = {u, targets[next].end, targets[next].w, reached};
+      for (const auto& e : targets)
+        state.is_target[e.end] = false;
+    }
+  }, 64);
+  return !failed.load();
+}
+
+double max_pair_stretch(const Graph& g, const Graph& spanner) {
+  return pair_stretch_stats(g, spanner).max;
+}
+
+double StretchStats::mean() const {
+  if (histogram.infinite() > 0)
+    return std::numeric_limits<double>::infinity();
+  return pairs() == 0 ? 0.0 : sum / pairs();
+}
+
+void StretchStats::merge(const StretchStats& other) {
+  max = std::max(max, other.max);
+  sum += other.sum;
+  histogram.merge(other.histogram);
+}
+
+namespace {
+  // The weight of every edge of g if they all weigh the same w > 0, else 0.
+  double common_weight(const Graph& g) {
+    double weight = 0;
+    for (int v = 0; v < g.size(); ++v) {
+      for (const auto& e : g.neighbors(v)) {
+        if (weight == 0)
+          weight = e.w;
+        if (e.w != weight || !(e.w > 0))
+          return 0;
+      }
+    }
+    return weight;
+  }
+
+  void sort_edge_stretches(std::vector<EdgeStretch>& edge_stretches) {
+    std::sort(std::begin(edge_stretches), std::end(edge_stretches),
+        [] (const EdgeStretch& a, const EdgeStretch& b) {
+          return std::make_pair(a.u, a.v) < std::make_pair(b.u, b.v);
+        });
+  }
+
+  // pair_stretch_stats of a graph whose edges all weigh w, where distances
+  // are hop counts times w: the sources are taken 64 at a time by bit
+  // parallel BFSs, first in g (recording the hop distances of the batch,
+  // O(64 n) per thread) and then in the spanner.
+  StretchStats uniform_pair_stretch_stats(const Graph& g,
+      const Graph& spanner, double w,
+      std::vector<EdgeStretch>* edge_stretches) {
+    constexpr int kBatch = BitParallelBfs::kMaxSources;
+    const CsrGraph g_csr(g), s_csr(spanner);
+    const int n = g.size();
+    struct Worker {
+      BitParallelBfs g_bfs, s_bfs;
+      // g_hops[v * kBatch + j] is the distance in g from source j to v.
+      std::vector<int> g_hops;
+      std::vector<int> sources;
+      StretchStats stats;
+      std::vector<EdgeStretch> edges;
+      explicit Worker(int n): g_bfs(n), s_bfs(n), g_hops(long(n) * kBatch) {}
+    };
+    std::vector<Worker> workers(util::num_threads(), Worker(n));
+    util::parallel_for(0, (n + kBatch - 1) / kBatch, [&] (int worker, int b) {
+      auto& state = workers[worker];
+      auto& stats = state.stats;
+      const int first = b * kBatch;
+      state.sources.clear();
+      for (int src = first; src < std::min(n, first + kBatch); ++src)
+        state.sources.push_back(src);
+      // Every unordered pair is counted from its smaller vertex.
+      auto smaller_sources = [&] (int v) {
+        return v - first >= kBatch ? ~uint64_t(0) :
+          v <= first ? 0 : (uint64_t(1) << (v - first)) - 1;
+      };
+      auto add = [&] (int v, uint64_t bits, double spanner_hops) {
+        for (bits &= smaller_sources(v); bits; bits &= bits - 1) {
+          const int j = __builtin_ctzll(bits);
+          const int g_hops = state.g_hops[long(v) * kBatch + j];
+          const double stretch = spanner_hops / g_hops;
+          stats.max = std::max(stats.max, stretch);
+          if (!std::isinf(stretch))
+            stats.sum += stretch;
+          stats.histogram.add(stretch);
+          if (edge_stretches && g_hops == 1)
+            state.edges.push_back({first + j, v, w, spanner_hops});
+        }
+      };
+      state.g_bfs.run(g_csr, state.sources,
+          [&] (int v, uint64_t bits, int hops) {
+            for (; bits; bits &= bits - 1)
+              state.g_hops[long(v) * kBatch + __builtin_ctzll(bits)] = hops;
+          });
+      state.s_bfs.run(s_csr, state.sources,
+          [&] (int v, uint64_t bits, int hops) { add(v, bits, hops); });
+      for (int v = first + 1; v < n; ++v) {
+        add(v, state.g_bfs.reached(v) & ~state.s_bfs.reached(v),
+            std::numeric_limits<double>::infinity());
+      }
+    }, 1);
+    StretchStats stats;
+    for (const auto& state : workers)
+      stats.merge(state.stats);
+    if (edge_stretches) {
+      edge_stretches->clear();
+      for (const auto& state : workers) {
+        edge_stretches->insert(std::end(*edge_stretches),
+            std::begin(state.edges), std::end(state.edges));
+      }
+      sort_edge_stretches(*edge_stretches);
+    }
+    return stats;
+  }
+}  // namespace
+
+StretchStats pair_stretch_stats(const Graph& g, const Graph& spanner,
+    std::vector<EdgeStretch>* edge_stretches,
+    const PairStretchOptions& options) {
+  const double w = common_weight(g);
+  if (w > 0)
+    return uniform_pair_stretch_stats(g, spanner, w, edge_stretches);
+  struct Worker {
+    StretchStats stats;
+    std::vector<EdgeStretch> edges;
+  };
+  std::vector<Worker> workers(util::num_threads());
+  auto add_pair = [] (Worker& state, double g_distance, double s_distance) {
+    const double stretch = s_distance / g_distance;
+    state.stats.max = std::max(state.stats.max, stretch);
+    if (!std::isinf(stretch))
+      state.stats.sum += stretch;
+    state.stats.histogram.add(stretch);
+  };
+  // s_distance(v) is the distance from src to v in the spanner.
+  auto add_edges = [&] (Worker& state, int src, auto&& s_distance) {
+    if (!edge_stretches)
+      return;
+    for (const auto& e : g.neighbors(src)) {
+      if (src < e.end && e.w > 0)
+        state.edges.push_back({src, e.end, e.w, s_distance(e.end) / e.w});
+    }
+  };
+
+  // Compares the rows of the all pairs matrices of T of g and the spanner.
+  auto sweep_matrices = [&] (auto zero) {
+    using T = decltype(zero);
+    const auto g_dists = all_pairs_shortest_paths<T>(g, ApspAlgorithm::AUTO,
+        options.packed);
+    const auto s_dists = all_pairs_shortest_paths<T>(spanner,
+        ApspAlgorithm::AUTO, options.packed);
+    util::parallel_for(0, g.size(), [&] (int worker, int src) {
+      auto& state = workers[worker];
+      for (int v = src + 1; v < g.size(); ++v) {
+        // If two vertices are disconnected in g (or at distance 0) they have
+        // no stretch.
+        const double d = g_dists(src, v);
+        if (d > 0 && !std::isinf(d))
+          add_pair(state, d, s_dists(src, v));
+      }
+      add_edges(state, src, [&] (int v) { return s_dists(src, v); });
+    }, 16);
+  };
+
+  if (options.apsp_matrices && options.single_precision) {
+    sweep_matrices(0.0f);
+  } else if (options.apsp_matrices) {
+    sweep_matrices(0.0);
+  } else {
+    // Inside the parallel_for sssp runs the radix heap Dijkstra.
+    const CsrGraph g_csr(g), s_csr(spanner);
+    util::parallel_for(0, g.size(), [&] (int worker, int src) {
+      auto& state = workers[worker];
+      const auto g_dists = sssp(g_csr, src);
+      auto connected = [&] (int v) {
+        return g_dists[v] > 0 && !std::isinf(g_dists[v]);
+      };
+      int v = src + 1;
+      while (v < g.size() && !connected(v))
+        ++v;
+      if (v == g.size())
+        return;
+      const auto s_dists = sssp(s_csr, src);
+      for (; v < g.size(); ++v) {
+        if (connected(v))
+          add_pair(state, g_dists[v], s_dists[v]);
+      }
+      add_edges(state, src, [&] (int v) { return s_dists[v]; });
+    });
+  }
+  StretchStats stats;
+  for (const auto& state : workers)
+    stats.merge(state.stats);
+  if (edge_stretches) {
+    edge_stretches->clear();
+    for (const auto& state : workers) {
+      edge_stretches->insert(std::end(*edge_stretches),
+          std::begin(state.edges), std::end(state.edges));
+    }
+    sort_edge_stretches(*edge_stretches);
+  }
+  return stats;
+}
+
+int StretchHistogram::bin_of(double stretch) {
+  if (!(stretch > 1.0))
+    return 0;
+  return std::max(1,
+      static_cast<int>(std::ceil(std::log(stretch) / std::log1p(kResolution))));
+}
+
+double StretchHistogram::value_of(int bin) {
+  return bin == 0 ? 1.0 : std::pow(1.0 + kResolution, bin - 0.5);
+}
+
+void StretchHistogram::add(double stretch, long count) {
+  if (std::isinf(stretch)) {
+    infinite_count += count;
+    total += count;
+  } else {
+    add_to_bin(bin_of(stretch), count);
+  }
+}
+
+void StretchHistogram::add_to_bin(int bin, long count) {
+  if (bin >= static_cast<int>(counts.size()))
+    counts.resize(bin + 1, 0);
+  counts[bin] += count;
+  total += count;
+}
+
+void StretchHistogram::merge(const StretchHistogram& other) {
+  if (other.counts.size() > counts.size())
+    counts.resize(other.counts.size(), 0);
+  for (size_t bin = 0; bin < other.counts.size(); ++bin)
+    counts[bin] += other.counts[bin];
+  infinite_count += other.infinite_count;
+  total += other.total;
+}
+
+double StretchHistogram::quantile(double q) const {
+  if (total == 0)
+    return 0.0;
+  const long rank = std::max(1L, static_cast<long>(std::ceil(q * total)));
+  long seen = 0;
+  for (size_t bin = 0; bin < counts.size(); ++bin) {
+    seen += counts[bin];
+    if (seen >= rank)
+      return value_of(bin);
+  }
+  return std::numeric_limits<double>::infinity();
+}
+
+namespace {
+  // Inverse of the standard normal cdf.
+  double normal_quantile(double p) {
+    double low = -40, high = 40;
+    for (int i = 0; i < 200; ++i) {
+      double mid = (low + high) / 2;
+      if (0.5 * std::erfc(-mid / std::sqrt(2.0)) < p) {
+        low = mid;
+      } else {
+        high = mid;
+      }
+    }
+    return (low + high) / 2;
+  }
+
+  // What a single sampling unit - a source, or a pair - measured.
+  struct SampleUnit {
+    double sum = 0.0;  // Of the finite stretches.
+    long pairs = 0;
+    long infinite = 0;
+    // Sparse histogram of the stretches, sorted by bin.
+    std::vector<std::pair<int, long>> bins;
+  };
+
+  // Returns the ratio estimate sum(y(unit)) / sum(unit.pairs) over the units
+  // and its standard error, 'fpc' is the finite population correction.
+  template<typename Y>
+  std::pair<double, double> ratio_estimate(const std::vector<SampleUnit>& units,
+      Y&& y, double fpc) {
+    double sum_y = 0.0, sum_x = 0.0;
+    for (const auto& unit : units) {
+      sum_y += y(unit);
+      sum_x += unit.pairs;
+    }
+    if (sum_x == 0)
+      return {0.0, std::numeric_limits<double>::infinity()};
+    const double ratio = sum_y / sum_x;
+    const double m = units.size();
+    if (m < 2)
+      return {ratio, std::numeric_limits<double>::infinity()};
+    double residuals = 0.0;
+    for (const auto& unit : units) {
+      const double r = y(unit) - ratio * unit.pairs;
+      residuals += r * r;
+    }
+    const double mean_x = sum_x / m;
+    return {ratio,
+      std::sqrt(std::max(0.0, fpc) * residuals / (m - 1) / m) / mean_x};
+  }
+
+  struct SampleWorker {
+    DijkstraSearch g_search, s_search;
+    std::vector<int> reached;
+    // Dense scratch histogram of the current unit and the bins it touched.
+    std::vector<long> bins;
+    std::vector<int> touched;
+    explicit SampleWorker(int n): g_search(n), s_search(n) {}
+
+    void add(SampleUnit& unit, double stretch) {
+      ++unit.pairs;
+      if (std::isinf(stretch)) {
+        ++unit.infinite;
+        return;
+      }
+      unit.sum += stretch;
+      const int bin = StretchHistogram::bin_of(stretch);
+      if (bin >= static_cast<int>(bins.size()))
+        bins.resize(bin + 1, 0);
+      if (bins[bin]++ == 0)
+        touched.push_back(bin);
+    }
+
+    void finish(SampleUnit& unit) {
+      std::sort(std::begin(touched), std::end(touched));
+      for (int bin : touched) {
+        unit.bins.emplace_back(bin, bins[bin]);
+        bins[bin] = 0;
+      }
+      touched.clear();
+    }
+
+    // All the pairs (src, v) connected in g.
+    SampleUnit measure_source(const CsrGraph& g, const CsrGraph& s, int src) {
+      SampleUnit unit;
+      reached.clear();
+      g_search.run(g, src, [&] (int v, double d) {
+        if (d > 0)
+          reached.push_back(v);
+        return true;
+      });
+      if (!reached.empty()) {
+        s_search.run(s, src, [] (int, double) { return true; });
+        for (int v : reached)
+          add(unit, s_search.distance(v) / g_search.distance(v));
+      }
+      finish(unit);
+      return unit;
+    }
+
+    // The single pair (src, target), if it is connected in g.
+    SampleUnit measure_pair(const CsrGraph& g, const CsrGraph& s, int src,
+        int target) {
+      SampleUnit unit;
+      auto until_target = [target] (int v, double) { return v != target; };
+      g_search.run(g, src, until_target);
+      const double g_dist = g_search.distance(target);
+      if (g_dist > 0 && !std::isinf(g_dist)) {
+        s_search.run(s, src, until_target);
+        add(unit, s_search.distance(target) / g_dist);
+      }
+      finish(unit);
+      return unit;
+    }
+  };
+}  // namespace
+
+StretchSampleResult sample_stretch(const Graph& g, const Graph& spanner,
+    const StretchSampleOptions& options) {
+  const int n = g.size();
+  StretchSampleResult result{{0, 0, 0}, {}, 0, 0, false};
+  if (n < 2)
+    return result;
+  const CsrGraph g_csr(g), s_csr(spanner);
+  const double z = normal_quantile(0.5 + options.confidence / 2);
+  const int limit = options.sample_pairs ? options.max_samples :
+    std::min(options.max_samples, n);
+  util::RandomEngine generator(options.seed);
+  // Sources are drawn without replacement, sources[0, drawn) are the drawn
+  // ones.
+  std::vector<int> sources(n);
+  std::iota(std::begin(sources), std::end(sources), 0);
+  int drawn = 0;
+  std::vector<SampleWorker> workers(util::num_threads(), SampleWorker(n));
+  std::vector<SampleUnit> units;
+  StretchHistogram pooled;
+  long infinite = 0;
+
+  // Fills result from the units sampled so far, returns true if all the
+  // estimates reached the target precision.
+  auto estimate = [&] () -> bool {
+    const double fpc = options.sample_pairs ? 1.0 :
+      1.0 - static_cast<double>(units.size()) / n;
+    result.samples = units.size();
+    result.pairs = pooled.count();
+    result.percentiles.clear();
+    if (infinite > 0) {
+      // Some pair is disconnected in the spanner.
+      const double inf = std::numeric_limits<double>::infinity();
+      result.average = {inf, inf, inf};
+      return false;
+    }
+    auto average = ratio_estimate(units,
+        [] (const SampleUnit& unit) { return unit.sum; }, fpc);
+    result.average = {average.first, average.first - z * average.second,
+      average.first + z * average.second};
+    bool precise = z * average.second <=
+      options.target_precision * average.first;
+    for (double percentile : options.percentiles) {
+      const double q = percentile / 100.0;
+      const int bin = StretchHistogram::bin_of(pooled.quantile(q));
+      // Woodruff: a confidence interval for the fraction of pairs whose
+      // stretch is at most the estimated percentile, mapped back through the
+      // pooled distribution.
+      auto fraction = ratio_estimate(units, [bin] (const SampleUnit& unit) {
+        double below = 0;
+        for (const auto& bin_count : unit.bins) {
+          if (bin_count.first > bin)
+            break;
+          below += bin_count.second;
+        }
+        return below;
+      }, fpc);
+      Estimate e{pooled.quantile(q),
+        pooled.quantile(std::max(0.0, q - z * fraction.second)),
+        pooled.quantile(std::min(1.0, q + z * fraction.second))};
+      precise = precise &&
+        (e.high - e.low) / 2 <= options.target_precision * e.value;
+      result.percentiles.emplace_back(percentile, e);
+    }
+    return precise;
+  };
+
+  const int batch_size = 4 * util::num_threads();
+  while (static_cast<int>(units.size()) < limit) {
+    // The units of a batch are drawn up front so the result only depends on
+    // the seed and not on the scheduling.
+    std::vector<std::pair<int, int>> batch;
+    while (static_cast<int>(units.size() + batch.size()) < limit &&
+        static_cast<int>(batch.size()) < batch_size) {
+      if (options.sample_pairs) {
+        int src = std::uniform_int_distribution<int>(0, n - 1)(generator);
+        int target = std::uniform_int_distribution<int>(0, n - 2)(generator);
+        batch.emplace_back(src, target >= src ? target + 1 : target);
+      } else {
+        int pick = std::uniform_int_distribution<int>(drawn, n - 1)(generator);
+        std::swap(sources[drawn], sources[pick]);
+        batch.emplace_back(sources[drawn++], -1);
+      }
+    }
+    std::vector<SampleUnit> measured(batch.size());
+    util::parallel_for(0, batch.size(), [&] (int worker, int i) {
+      auto& state = workers[worker];
+      measured[i] = options.sample_pairs ?
+        state.measure_pair(g_csr, s_csr, batch[i].first, batch[i].second) :
+        state.measure_source(g_csr, s_csr, batch[i].first);
+    });
+    for (auto& unit : measured) {
+      for (const auto& bin_count : unit.bins)
+        pooled.add_to_bin(bin_count.first, bin_count.second);
+      if (unit.infinite > 0)
+        pooled.add(std::numeric_limits<double>::infinity(), unit.infinite);
+      infinite += unit.infinite;
+      units.push_back(std::move(unit));
+    }
+    if (infinite > 0)
+      break;
+    if (static_cast<int>(units.size()) >= options.min_samples && estimate()) {
+      result.converged = true;
+      return result;
+    }
+  }
+  result.converged = estimate();
+  return result;
+}
+}  // namespace graphs
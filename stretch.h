@@ -0,0 +1,168 @@
+#ifndef STRETCH_H
+#define STRETCH_H
+#include <utility>
+#include <vector>
+#include "graph.h"
+
+namespace graphs {
+  // Returns the maximum stretch d_spanner(u, v) / d_g(u, v) over all pairs of
+  // vertices connected in g, where spanner is a subgraph of g (0 if g has no
+  // edges of positive weight).
+  //
+  // The maximum is always reached on an edge of g: stretching every edge of a
+  // shortest path by at most t stretches the path by at most t. So instead of
+  // all pairs distances this runs, in parallel over the vertices u, a Dijkstra
+  // from u in the spanner that stops as soon as every v > u with an edge
+  // (u, v) in g but not in the spanner was settled. For a (2k-1)-spanner that
+  // search never goes beyond (2k-1) times the heaviest such edge.
+  double max_edge_stretch(const Graph& g, const Graph& spanner);
+
+  // An edge of g whose distance in the spanner exceeds its allowed stretch.
+  struct StretchViolation {
+    int u;
+    int v;
+    double w;
+    // Lower bound on d_spanner(u, v) (the search stops once it passed the
+    // bound), infinity if they are disconnected in the spanner.
+    double spanner_distance;
+  };
+
+  // Returns true if d_spanner(u, v) <= bound * w(u, v) for every edge (u, v)
+  // of g, which for bound >= 1 is equivalent to the spanner's stretch being at
+  // most 'bound'.
+  // Otherwise returns false, and fills 'violation' (if not null) with the
+  // first violating edge found. Like max_edge_stretch it searches the spanner
+  // from every vertex in parallel, but a search stops as soon as its distance
+  // passes bound times the lightest edge it has yet to cover, and all the
+  // searches stop once a violation was found.
+  bool verify_stretch(const Graph& g, const Graph& spanner, double bound,
+      StretchViolation* violation = nullptr);
+
+  // Same maximum, computed by comparing distances of all pairs, see
+  // pair_stretch_stats.
+  double max_pair_stretch(const Graph& g, const Graph& spanner);
+
+  // Counts stretches in logarithmic bins: bin 0 holds the stretches <= 1 and
+  // bin b > 0 the ones in ((1 + r)^(b - 1), (1 + r)^b] where r = kResolution,
+  // so every value read back from it is within a relative error of r / 2.
+  class StretchHistogram {
+    public:
+      static constexpr double kResolution = 1e-3;
+
+      static int bin_of(double stretch);
+      // The value a bin reports, its geometric center (or 1 for bin 0).
+      static double value_of(int bin);
+
+      void add(double stretch, long count = 1);
+      void add_to_bin(int bin, long count);
+      void merge(const StretchHistogram& other);
+
+      // Number of values, including the infinite ones.
+      long count() const { return total; }
+      long infinite() const { return infinite_count; }
+      const std::vector<long>& bins() const { return counts; }
+      // The smallest bin value s such that a fraction q of the values is <= s.
+      double quantile(double q) const;
+
+    private:
+      std::vector<long> counts;
+      long infinite_count = 0;
+      long total = 0;
+  };
+
+  // The stretch of an edge (u, v) of g, d_spanner(u, v) / w(u, v), u < v.
+  struct EdgeStretch {
+    int u;
+    int v;
+    double w;
+    double stretch;
+  };
+
+  // Statistics of the stretch over all pairs of vertices connected in g (at a
+  // positive distance), every unordered pair counted once.
+  struct StretchStats {
+    double max = 0.0;
+    // Sum of the finite stretches.
+    double sum = 0.0;
+    StretchHistogram histogram;
+
+    long pairs() const { return histogram.count(); }
+    // Infinity if some pair is disconnected in the spanner.
+    double mean() const;
+    // Within the histogram's resolution.
+    double quantile(double q) const { return histogram.quantile(q); }
+    void merge(const StretchStats& other);
+  };
+
+  struct PairStretchOptions {
+    // If set, the weighted sweep compares the rows of the all pairs distance
+    // matrices of both graphs, computed first by all_pairs_shortest_paths
+    // (which picks Dijkstra or Floyd-Warshall for each graph). The two packed
+    // matrices take about n^2 * sizeof(double) bytes.
+    bool apsp_matrices = false;
+    // With apsp_matrices, float matrices take half the memory (and
+    // Floyd-Warshall runs twice as many lanes per instruction), but the
+    // distances keep only about 7 significant digits.
+    bool single_precision = false;
+    // With apsp_matrices, full rather than packed matrices take twice the
+    // memory but are indexed without folding (i, j) onto the lower triangle.
+    bool packed = true;
+  };
+
+  // Computes all of StretchStats in one sweep over the sources, in parallel.
+  // A worker runs a single source search (sssp) from the source in g and in
+  // the spanner and compares the two rows, so every thread keeps O(n) state
+  // (and its own stats, merged once the sweep is done) and no distance matrix
+  // is built, unless options.apsp_matrices is set. If edge_stretches isn't
+  // null it also gets the stretch of every edge of g of positive weight,
+  // sorted by (u, v), at no extra search.
+  // If all the edges of g weigh the same (e.g unit weights) distances are hop
+  // counts, and BitParallelBfs searches from 64 sources at a time replace
+  // the Dijkstra searches, which makes graphs of 10^5 vertices tractable.
+  StretchStats pair_stretch_stats(const Graph& g, const Graph& spanner,
+      std::vector<EdgeStretch>* edge_stretches = nullptr,
+      const PairStretchOptions& options = PairStretchOptions());
+
+  // A point estimate with its confidence interval.
+  struct Estimate {
+    double value;
+    double low;
+    double high;
+  };
+
+  struct StretchSampleOptions {
+    // Sample random pairs of vertices instead of random sources (with all
+    // their targets).
+    bool sample_pairs = false;
+    double confidence = 0.95;
+    // Sampling stops once every estimate's confidence interval is within
+    // this fraction of the estimate.
+    double target_precision = 0.01;
+    std::vector<double> percentiles = {50, 90, 99};
+    int min_samples = 30;
+    int max_samples = 100000;
+    unsigned long seed = 0;
+  };
+
+  struct StretchSampleResult {
+    Estimate average;
+    // (percentile, estimate) in the order of StretchSampleOptions.
+    std::vector<std::pair<double, Estimate>> percentiles;
+    // Number of sources (or pairs) sampled and of pairs they measured.
+    int samples;
+    long pairs;
+    bool converged;
+  };
+
+  // Estimates the average and the percentiles of the stretch of 'spanner'
+  // over all pairs of vertices connected in g, without computing all pairs
+  // distances. Sources are drawn without replacement and each costs two
+  // single source searches; the pairs of a source are correlated, so the
+  // confidence intervals use the sources as sampling units (a ratio
+  // estimator for the average and Woodruff's method for the percentiles).
+  // Samples are drawn in parallel batches until the requested precision, or
+  // max_samples, is reached. Sampling every source gives the exact values.
+  StretchSampleResult sample_stretch(const Graph& g, const Graph& spanner,
+      const StretchSampleOptions& options);
+}  // namespace graphs
+#endif
@@ -1,54 +1,91 @@
 #include "three-spanner-algorithm.h"
 #include <vector>
-#include <unordered_map>
 #include <unordered_set>
-#include <ctime>
+#include <cstdint>
 #include <iostream>
+#include <limits>
 #include <cstdlib>
 #include <cassert>
+#include <random>
+#include "sparse_accumulator.h"
 #include "util.h"
 
 namespace graphs {
   using scoped_timer = util::scoped_timer;
-  using util::random_real;
 namespace {
   using namespace std;
   using Clusters = vector<int>; 
-  auto sample(const Graph& g) {
+
+  // A uniform real in [0, 1) that depends only on (seed, v), so the sample
+  // is the same whatever thread draws it and in whatever order.
+  double hash_real(unsigned long seed, int v) {
+    // splitmix64's finalizer.
+    uint64_t x = seed + 0x9e3779b97f4a7c15ull * (static_cast<uint64_t>(v) + 1);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    // The top 53 bits over 2^53.
+    return (x >> 11) / 9007199254740992.0;
+  }
+
+  void sample(const Graph& g, unsigned long seed, Clusters& sampled_vertices) {
 //    scoped_timer st("sample"); 
     auto probability = 1.0 / sqrt(static_cast<double>(g.size()));
-    Clusters sampled_vertices(g.size(), -1);
-    srand(std::time(0));
-    for (int i = 0; i < g.size(); ++i) {
-     if (random_real() < probability) { 
+    sampled_vertices.assign(g.size(), -1);
+    util::parallel_for(0, g.size(), [&] (int, int i) {
+     if (hash_real(seed, i) < probability) { 
         sampled_vertices[i] = i;
       }
-    }
-    return sampled_vertices;
+    }, 1024);
   } 
 
-  auto form_clusters(Graph g, Graph& spanner) {
+  // Orders edges by weight, then by end vertex.
+  bool lighter(const Edge& a, const Edge& b) {
+    return a.w < b.w || (a.w == b.w && a.end < b.end);
+  }
+
+  // The lightest edge from a vertex to each of its neighboring clusters.
+  using ClusterToMinEdge = SparseAccumulator<Edge>;
+
+  // Spanner edges found by one thread, added to the spanner once all the
+  // threads are done.
+  using EdgeBuffer = vector<ExtendedEdge>;
+
+  void add_buffers(const vector<EdgeBuffer>& buffers, Graph& spanner) {
+    for (const auto& buffer : buffers) {
+      for (const auto& e : buffer) {
+        spanner.add_edge(e.u, e.v, e.w);
+      }
+    }
+  }
+
+  auto form_clusters(const Graph& g, unsigned long seed, Graph& spanner) {
     //scoped_timer st("form_cluster");
-    auto clusters = sample(g);
+    Clusters sampled;
+    sample(g, seed, sampled);
+    auto clusters = sampled;
+    vector<EdgeBuffer> buffers(util::num_threads());
 
     // Possible optimization - give up on the unsampled_vertices and only use
     // the clusters.
-    for(int unsampled_vertex = 0; unsampled_vertex < g.size();
-        ++unsampled_vertex) {
+    util::parallel_for(0, g.size(), [&] (int worker, int unsampled_vertex) {
       // If this is a sampled vertex continue the loop;
-      if (clusters[unsampled_vertex] == unsampled_vertex) {
-          continue;
+      if (sampled[unsampled_vertex] == unsampled_vertex) {
+          return;
       }
+      auto& buffer = buffers[worker];
       const auto& neighbors = g.neighbors(unsampled_vertex);
       Edge sentinel_edge{-1, 0}; 
       // Pick the best edge adjacent to a sampled vertex, if there are non the
-      // sentinel edge is returned.
+      // sentinel edge is returned. Ties go to the smaller vertex, so the
+      // choice doesn't depend on the order of the hash set.
       auto best_edge = accumulate(begin(neighbors), end(neighbors),
           sentinel_edge,
-          [&clusters] (Edge acc, auto&& next_edge) {
-              if (clusters[next_edge.end] == next_edge.end) {
-                return (acc.end == -1) ? next_edge :
-                       (next_edge.w < acc.w ? next_edge : acc);
+          [&sampled] (Edge acc, auto&& next_edge) {
+              if (sampled[next_edge.end] == next_edge.end) {
+                return (acc.end == -1 || next_edge.w < acc.w ||
+                    (next_edge.w == acc.w && next_edge.end < acc.end)) ?
+                  next_edge : acc;
               } else {
                 return acc;
               }
@@ -56,54 +93,182 @@ namespace {
       // This vertex is not adjacent to any sampled vertices - add all of its
       // edges to the spanner.
       if (best_edge == sentinel_edge) {
-        spanner.add_vertex_with_edges(unsampled_vertex, neighbors); 
+        for (auto&& edge : neighbors)
+          buffer.emplace_back(unsampled_vertex, edge.end, edge.w);
       } else {
         // Add this vertex to the cluster at best_edge.end
         clusters[unsampled_vertex] = best_edge.end;
-        spanner.add_edge(unsampled_vertex, best_edge.end, best_edge.w);
+        buffer.emplace_back(unsampled_vertex, best_edge.end, best_edge.w);
         for (auto&& edge : neighbors) {
           if (edge < best_edge)
-            spanner.add_edge(unsampled_vertex, edge.end, edge.w);
+            buffer.emplace_back(unsampled_vertex, edge.end, edge.w);
         }
       }
-    }
-     auto filtered_g = filter_edges(g,
-         [&clusters, &spanner] (int start, int end) {
-          // Remove edges that are in spanner and intra cluster edges. 
-          return spanner.has_edge(start, end) ||
-         (clusters[start] != -1 && clusters[start] == clusters[end]);
-          }); 
-    return make_pair(clusters, filtered_g);
+    }, 256);
+    add_buffers(buffers, spanner);
+    return clusters;
   }
   
-  auto join_clusters(const Clusters& clusters, const Graph& not_added_graph,
+  // Joins every vertex to each of its neighboring clusters through the
+  // lightest edge between them, skipping the edges that are already in the
+  // spanner and the intra cluster edges.
+  void join_clusters(const Graph& g, const Clusters& clusters,
                      Graph& spanner) {
     //scoped_timer st("join_clusters");
-    for (int i = 0; i < not_added_graph.size() ; ++i) {
-      const auto& neighbors = not_added_graph.neighbors(i);
-      unordered_map<int, Edge> cluster_representives;
+    vector<EdgeBuffer> buffers(util::num_threads());
+    vector<ClusterToMinEdge> representives(util::num_threads());
+    util::parallel_for(0, g.size(), [&] (int worker, int i) {
+      const auto& neighbors = g.neighbors(i);
+      auto& cluster_representives = representives[worker];
+      cluster_representives.grow(g.size(), Edge{-1, 0});
       for (const auto& e : neighbors) {
-        auto current_rep = cluster_representives.find(e.end);
-        if (current_rep == std::end(cluster_representives)) { 
-          cluster_representives.emplace(clusters[e.end], e);
-        } else if (current_rep->second > e) {
-          current_rep->second = e;
-         }
+        if (spanner.has_edge(i, e.end) ||
+            (clusters[i] != -1 && clusters[i] == clusters[e.end])) {
+          continue;
+        }
+        cluster_representives.min(clusters[e.end], e, lighter);
+      }
+      for (int cluster : cluster_representives.keys()) {
+        const auto& rep = cluster_representives[cluster];
+        buffers[worker].emplace_back(i, rep.end, rep.w);
+      }
+      cluster_representives.clear();
+    }, 256);
+    add_buffers(buffers, spanner);
+  }
+
+  // The fused implementation. A first pass finds the cluster of every vertex
+  // and the weight of its edge to the center, its radius; the edges the first
+  // phase adds at v are then exactly those lighter than v's radius plus the
+  // one to its center (all of them if v has no sampled neighbor, none if v is
+  // sampled). So whether an edge is already in the spanner is a comparison at
+  // each endpoint, and a second pass emits both phases' edges of every vertex
+  // without building the spanner (or a filtered graph) in between.
+  //
+  // The state of a run, kept from one graph to the next by the batch entry
+  // points. 'buffers' gets the edges found by every thread, an edge may be
+  // found at both endpoints.
+  struct FusedScratch {
+    Clusters sampled, clusters;
+    vector<double> radius;
+    vector<EdgeBuffer> buffers;
+    vector<ClusterToMinEdge> representives;
+  };
+
+  void fused_three_spanner(const Graph& g, unsigned long seed,
+      FusedScratch& scratch) {
+    const int n = g.size();
+    auto& sampled = scratch.sampled;
+    auto& clusters = scratch.clusters;
+    auto& radius = scratch.radius;
+    sample(g, seed, sampled);
+    clusters = sampled;
+    radius.assign(n, 0);
+    util::parallel_for(0, n, [&] (int, int v) {
+      if (sampled[v] == v)
+        return;
+      Edge best{-1, numeric_limits<double>::infinity()};
+      for (const auto& e : g.neighbors(v)) {
+        if (sampled[e.end] == e.end &&
+            (e.w < best.w || (e.w == best.w && e.end < best.end))) {
+          best = e;
+        }
+      }
+      clusters[v] = best.end;
+      radius[v] = best.w;
+    }, 1024);
+    auto added_by = [&] (int v, const Edge& e) {
+      return sampled[v] != v && (e.w < radius[v] || e.end == clusters[v]);
+    };
+
+    auto& buffers = scratch.buffers;
+    buffers.resize(util::num_threads());
+    for (auto& buffer : buffers)
+      buffer.clear();
+    scratch.representives.resize(util::num_threads());
+    util::parallel_for(0, n, [&] (int worker, int v) {
+      auto& edges = buffers[worker];
+      auto& best = scratch.representives[worker];
+      best.grow(n, Edge{-1, 0});
+      for (const auto& e : g.neighbors(v)) {
+        if (added_by(v, e)) {
+          edges.emplace_back(v, e.end, e.w);
+          continue;
+        }
+        const int cluster = clusters[e.end];
+        if (added_by(e.end, Edge{v, e.w}) ||
+            (clusters[v] != -1 && clusters[v] == cluster)) {
+          continue;
+        }
+        best.min(cluster, e, lighter);
       }
-      for (auto&& reps : cluster_representives) {
-        spanner.add_edge(i, reps.second.end, reps.second.w);
+      for (int cluster : best.keys()) {
+        edges.emplace_back(v, best[cluster].end, best[cluster].w);
       }
-    } 
+      best.clear();
+    }, 256);
+  }
+
+  // The edges of the fused 3-spanner of g, sorted and deduplicated.
+  std::vector<ExtendedEdge> fused_three_spanner_edges(const Graph& g,
+      unsigned long seed, FusedScratch& scratch) {
+    fused_three_spanner(g, seed, scratch);
+    std::vector<ExtendedEdge> edges;
+    for (const auto& buffer : scratch.buffers)
+      edges.insert(std::end(edges), std::begin(buffer), std::end(buffer));
+    sort_and_dedup_edges(edges);
+    return edges;
   }
 }  // namespace.
 
 Graph three_spanner(Graph g) {
+  return three_spanner(std::move(g), std::random_device{}());
+}
+
+Graph three_spanner(Graph g, unsigned long seed) {
   //scoped_timer st("three-span");
+  if (util::get_bool_flag("fused_three_spanner")) {
+    FusedScratch scratch;
+    fused_three_spanner(g, seed, scratch);
+    Graph spanner(g.size());
+    add_buffers(scratch.buffers, spanner);
+    return spanner;
+  }
   Graph spanner(g.size());
-  auto clusters_and_not_added_edges = form_clusters(std::move(g), spanner);
-  join_clusters(clusters_and_not_added_edges.first,
-      clusters_and_not_added_edges.second,
-      spanner);
+  const auto clusters = form_clusters(g, seed, spanner);
+  join_clusters(g, clusters, spanner);
   return spanner;
 }
+
+std::vector<ExtendedEdge> three_spanner_edges(Graph g) {
+  return three_spanner_edges(std::move(g), std::random_device{}());
+}
+
+std::vector<ExtendedEdge> three_spanner_edges(Graph g, unsigned long seed) {
+  if (util::get_bool_flag("fused_three_spanner")) {
+    FusedScratch scratch;
+    return fused_three_spanner_edges(g, seed, scratch);
+  }
+  std::vector<ExtendedEdge> edges;
+  const auto spanner = three_spanner(std::move(g), seed);
+  for (int v = 0; v < spanner.size(); ++v)
+    for (const auto& e : spanner.neighbors(v))
+      if (v <= e.end)
+        edges.emplace_back(v, e.end, e.w);
+  sort_and_dedup_edges(edges);
+  return edges;
+}
+
+std::vector<std::vector<ExtendedEdge>> three_spanner_batch(
+    const std::vector<Graph>& graphs, unsigned long seed) {
+  std::vector<std::vector<ExtendedEdge>> spanners(graphs.size());
+  const bool fused = util::get_bool_flag("fused_three_spanner");
+  std::vector<FusedScratch> scratch(util::num_threads());
+  util::parallel_for(0, graphs.size(), [&] (int worker, int i) {
+    spanners[i] = fused ?
+      fused_three_spanner_edges(graphs[i], seed + i, scratch[worker]) :
+      three_spanner_edges(graphs[i], seed + i);
+  });
+  return spanners;
+}
 } // namespace graphs
@@ -38,7 +38,31 @@ namespace graphs {
   // Let E<s,1> and E<s,2> be the sets of edges added to the spanner in the
   // first phase and the second phase respectively. G(V, E1 union E2) is a
   // spanner.
+  //
+  // Both phases run in parallel over the vertices, with the edges buffered
+  // per thread and added to the spanner at the end of the phase. The sample
+  // is a hash of (seed, v) and ties between edges of equal weight go to the
+  // smaller vertex, so the spanner depends only on g and the seed.
+  // With --fused_three_spanner (the default) both phases are done in a single
+  // pass over the edges, with no intermediate graph, see three-spanner-
+  // algorithm.cc. The spanner is the same.
+  Graph three_spanner(Graph g, unsigned long seed);
+  // Same with a random seed.
   Graph three_spanner(Graph g);
+
+  // The same spanner as a list of edges (u, v) with u <= v, sorted and
+  // without duplicates, for callers that don't need a Graph (which costs
+  // about as much to build as the clusters do). Convert it with
+  // graph_from_edges or a CsrGraph if needed.
+  std::vector<ExtendedEdge> three_spanner_edges(Graph g, unsigned long seed);
+  std::vector<ExtendedEdge> three_spanner_edges(Graph g);
+
+  // The 3-spanners (as edge lists) of many graphs, e.g thousands of small
+  // ones: the graphs are spread over the threads, and each thread reuses its
+  // buffers from one graph to the next. Spanner i is
+  // three_spanner_edges(graphs[i], seed + i).
+  std::vector<std::vector<ExtendedEdge>> three_spanner_batch(
+      const std::vector<Graph>& graphs, unsigned long seed);
 } // namespace graphs
 
 
@@ -1,13 +1,31 @@
 #include "util.h"
 #include <random>
 #include <ctime>
+#include <functional>
+#include <thread>
 namespace util {
 using std::string;
 double random_real() {
-  static std::minstd_rand0 generator(std::time(0));
-  static std::uniform_real_distribution<double> dst(0, 1);
+  // One generator per thread: spanners are built concurrently, by the
+  // experiments and by the batch entry points.
+  thread_local std::minstd_rand0 generator(std::time(0) +
+      std::hash<std::thread::id>()(std::this_thread::get_id()));
+  std::uniform_real_distribution<double> dst(0, 1);
   return dst(generator);
 }
+namespace {
+  std::atomic<int> NUM_THREADS(
+      std::max(1u, std::thread::hardware_concurrency()));
+}  // namespace
+
+int num_threads() {
+  return NUM_THREADS;
+}
+
+void set_num_threads(int n) {
+  NUM_THREADS = std::max(1, n);
+}
+
 namespace {
   template<typename T>
     struct Flag {
@@ -6,6 +6,11 @@
 #include <random>
 #include <cassert>
 #include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
 #include "json.hpp"
 
 #define db std::cout << "debug: " << __func__ << ":" << __LINE__ << std::endl
@@ -30,6 +35,10 @@ namespace util {
       std::string name;
   };
 
+  // The engine used wherever random numbers have to be reproducible from a
+  // seed.
+  using RandomEngine = std::minstd_rand0;
+
   // returns a random real number between 0 .. 1, uniform
   double random_real();
 
@@ -50,5 +59,118 @@ namespace util {
   bool is_flag_set(const std::string& fname);
 
   std::string random_string(size_t length);
+
+  // The number of threads parallel_for uses, defaults to the number of cores.
+  int num_threads();
+  void set_num_threads(int n);
+
+  // True while the calling thread runs inside a parallel_for.
+  inline bool& in_parallel_for() {
+    thread_local bool in_parallel = false;
+    return in_parallel;
+  }
+
+  // Calls f(worker, i) for every i in [begin, end) on up to num_threads()
+  // threads. 'worker' is in [0, num_threads()) and is unique among the threads
+  // of this call, so callers can keep per-thread state in a vector indexed by
+  // it. Indices are handed out on demand in chunks of 'grain'. A parallel_for
+  // nested in another one runs on the calling thread only.
+  template<typename Func>
+  void parallel_for(int begin, int end, Func&& f, int grain = 1) {
+    if (begin >= end)
+      return;
+    const int chunks = (end - begin + grain - 1) / grain;
+    const int threads = in_parallel_for() ? 1 : std::min(num_threads(), chunks);
+    std::atomic<int> next(begin);
+    auto work = [&] (int worker) {
+      bool was_in_parallel = in_parallel_for();
+      in_parallel_for() = true;
+      for (int first = next.fetch_add(grain); first < end;
+          first = next.fetch_add(grain)) {
+        const int last = std::min(end, first + grain);
+        for (int i = first; i < last; ++i)
+          f(worker, i);
+      }
+      in_parallel_for() = was_in_parallel;
+    };
+    std::vector<std::thread> workers;
+    for (int worker = 1; worker < threads; ++worker)
+      workers.emplace_back(work, worker);
+    work(0);
+    for (auto& t : workers)
+      t.join();
+  }
+
+  // std::sort of [first, last) on up to num_threads() threads: equal slices
+  // are sorted in parallel and then merged pairwise, a round of parallel
+  // merges at a time. Small ranges are sorted on the calling thread.
+  template<typename It, typename Less>
+  void parallel_sort(It first, It last, Less less) {
+    constexpr long kMinSlice = 1 << 14;
+    const long n = last - first;
+    const int slices = in_parallel_for() ? 1 :
+      static_cast<int>(std::min<long>(num_threads(), n / kMinSlice));
+    if (slices <= 1) {
+      std::sort(first, last, less);
+      return;
+    }
+    auto bound = [&] (int slice) { return first + n * slice / slices; };
+    parallel_for(0, slices, [&] (int, int slice) {
+      std::sort(bound(slice), bound(slice + 1), less);
+    });
+    for (int width = 1; width < slices; width *= 2) {
+      parallel_for(0, (slices + 2 * width - 1) / (2 * width), [&] (int, int i) {
+        const int begin = 2 * width * i;
+        const int middle = std::min(slices, begin + width);
+        const int end = std::min(slices, begin + 2 * width);
+        std::inplace_merge(bound(begin), bound(middle), bound(end), less);
+      });
+    }
+  }
+
+  // Stable LSD radix sort of 'items' by key(item), an unsigned integer below
+  // 2^bits, a byte per pass. Every pass splits the items into one slice per
+  // thread: the threads count the digits of their slices, the counts are
+  // prefix summed digit by digit, slice by slice, and each thread scatters
+  // its slice to the offsets it got. T must be default constructible.
+  template<typename T, typename Key>
+  void parallel_radix_sort(std::vector<T>& items, Key key, int bits) {
+    constexpr int kDigitBits = 8;
+    constexpr int kBuckets = 1 << kDigitBits;
+    constexpr long kMinSlice = 1 << 14;
+    const long n = items.size();
+    const int slices = in_parallel_for() ? 1 :
+      static_cast<int>(std::max<long>(1,
+            std::min<long>(num_threads(), n / kMinSlice)));
+    auto bound = [&] (int slice) { return n * slice / slices; };
+    std::vector<T> buffer(n);
+    std::vector<long> offsets(slices * kBuckets);
+    for (int shift = 0; shift < bits; shift += kDigitBits) {
+      auto digit = [&] (const T& item) {
+        return static_cast<int>((uint64_t(key(item)) >> shift) &
+            (kBuckets - 1));
+      };
+      std::fill(std::begin(offsets), std::end(offsets), 0);
+      parallel_for(0, slices, [&] (int, int slice) {
+        long* counts = &offsets[slice * kBuckets];
+        for (long i = bound(slice); i < bound(slice + 1); ++i)
+          ++counts[digit(items[i])];
+      });
+      long total = 0;
+      for (int d = 0; d < kBuckets; ++d) {
+        for (int slice = 0; slice < slices; ++slice) {
+          const long count = offsets[slice * kBuckets + d];
+          offsets[slice * kBuckets + d] = total;
+          total += count;
+        }
+      }
+      parallel_for(0, slices, [&] (int, int slice) {
+        long* next = &offsets[slice * kBuckets];
+        for (long i = bound(slice); i < bound(slice + 1); ++i)
+          buffer[next[digit(items[i])]++] = items[i];
+      });
+      items.swap(buffer);
+    }
+  }
 } // namespace util.
 #endif